@@ -0,0 +1,53 @@
+#include "tile_decode.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#define TILES       384     // Every tile slot in VRAM
+#define ROUNDS      20000
+
+/*
+ * Decodes a full VRAM tile set over and over with every decoder this CPU
+ * can run, checks them against the scalar one and prints their throughput.
+ */
+int main()
+{
+    const size_t rows = TILES * 8;
+    std::vector<uint8_t> vram(rows * TILE_ROW_BYTES);
+    srand(1);
+    for(size_t i = 0; i < vram.size(); ++i)
+        vram[i] = rand();
+
+    const std::vector<tile_decoder_t> decoders = tile_decoders();
+    std::vector<uint8_t> expected(rows * TILE_ROW_PIXELS);
+    decoders.back().decode(&vram[0], &expected[0], rows);
+
+    double scalar_ns = 0;
+    for(size_t d = decoders.size(); d-- > 0;)
+    {
+        std::vector<uint8_t> out(rows * TILE_ROW_PIXELS);
+        decoders[d].decode(&vram[0], &out[0], rows);
+        if(out != expected)
+        {
+            printf("%-8s wrong result\n", decoders[d].name);
+            return 1;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < ROUNDS; ++i)
+        {
+            decoders[d].decode(&vram[0], &out[0], rows);
+            __asm__ __volatile__("" : : "r"(&out[0]) : "memory");
+        }
+        const double ns = std::chrono::duration<double, std::nano>(
+            std::chrono::steady_clock::now() - start).count() / ROUNDS;
+        if(!scalar_ns)
+            scalar_ns = ns;
+        printf("%-8s %8.0f ns per tile set  %6.2f GB/s out  %5.1fx\n", decoders[d].name, ns,
+               rows * TILE_ROW_PIXELS / ns, scalar_ns / ns);
+    }
+    return 0;
+}
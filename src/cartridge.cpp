@@ -0,0 +1,375 @@
+#include "cartridge.h"
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+
+cart_image_t::cart_image_t()
+    : rom_copy(2 * ROM_BANK_SIZE, 0x00), rom(&rom_copy[0]), mbc(MBC_NONE), rom_banks(2), ram_banks(0),
+      battery(false)
+{
+    memset(bootrom, 0x00, sizeof(bootrom));
+}
+
+bool cart_image_t::load(const std::string &filename)
+{
+    std::shared_ptr<const mapped_file_t> file = mapped_file_t::open_shared(filename);
+    if(!file || file->length() < 0x150)
+        return false;
+    const size_t size = file->length();
+
+    rom_banks = (size + ROM_BANK_SIZE - 1) / ROM_BANK_SIZE;
+    if(rom_banks >= 2 && size % ROM_BANK_SIZE == 0)
+    {
+        rom_copy.clear();
+        rom = file->get();
+        rom_file = file;
+    } else {
+        // Pad to whole banks, at least the two the unbanked map shows.
+        if(rom_banks < 2)
+            rom_banks = 2;
+        rom_copy.assign(rom_banks * ROM_BANK_SIZE, 0xFF);
+        memcpy(&rom_copy[0], file->get(), size);
+        rom = &rom_copy[0];
+        rom_file.reset();
+    }
+
+    const uint8_t type = rom[0x0147];
+    switch(type)
+    {
+        case 0x01: case 0x02: case 0x03:            mbc = MBC_1;    break;
+        case 0x05: case 0x06:                       mbc = MBC_2;    break;
+        case 0x0F: case 0x10: case 0x11:
+        case 0x12: case 0x13:                       mbc = MBC_3;    break;
+        case 0x19: case 0x1A: case 0x1B:
+        case 0x1C: case 0x1D: case 0x1E:            mbc = MBC_5;    break;
+        default:                                    mbc = MBC_NONE; break;
+    }
+
+    switch(rom[0x0149])
+    {
+        case 0x01:
+        case 0x02:  ram_banks = 1;  break;  // 2KB carts get a full bank
+        case 0x03:  ram_banks = 4;  break;
+        case 0x04:  ram_banks = 16; break;
+        case 0x05:  ram_banks = 8;  break;
+        default:    ram_banks = 0;  break;
+    }
+    if(mbc == MBC_2)
+        ram_banks = 1;      // 512 nibbles built into the controller
+    switch(type)
+    {
+        case 0x03: case 0x06: case 0x09: case 0x0F:
+        case 0x10: case 0x13: case 0x1B: case 0x1E: battery = true;  break;
+        default:                                    battery = false; break;
+    }
+    if(battery && ram_banks)
+        open_save(filename);
+
+    char name[0x11];
+    strncpy(name, (char*)&rom[0x134], 0x10);
+    name[0x10] = '\0';
+    std::cout << "Loaded rom " << name << "(size: " << size << ", cart mode: " << (int)type;
+    std::cout << ", rom banks: " << rom_banks << ", ram banks: " << (int)ram_banks << ")" << std::endl;
+    return true;
+}
+
+bool cart_image_t::load_bootrom(const std::string &filename)
+{
+    std::ifstream rom_in(filename.c_str(), std::ios::in | std::ios::binary);
+    if(!rom_in.is_open())
+        return false;
+    rom_in.read((char*)bootrom, sizeof(bootrom));
+    rom_in.close();
+    std::cout << "Loaded bootrom\n";
+    return true;
+}
+
+//! Maps the .sav file belonging to @param rom_filename. Without one the
+//! cartridge RAM is only kept in memory.
+void cart_image_t::open_save(const std::string &rom_filename)
+{
+    const size_t dot = rom_filename.find_last_of('.');
+    const size_t slash = rom_filename.find_last_of('/');
+    std::string save_filename = rom_filename;
+    if(dot != std::string::npos && (slash == std::string::npos || dot > slash))
+        save_filename.erase(dot);
+    save_filename += ".sav";
+
+    if(save_file.open_writable(save_filename, ram_banks * RAM_BANK_SIZE))
+        std::cout << "Using save file " << save_filename << std::endl;
+    else
+        std::cout << "Warning, can't open save file " << save_filename << std::endl;
+}
+
+//! Switches to a private copy of the ROM, so debug code can patch it. The
+//! shared mapping stays alive for machines that still point into it.
+void cart_image_t::make_rom_writable()
+{
+    if(!rom_copy.empty())
+        return;
+    rom_copy.assign(rom, rom + rom_banks * ROM_BANK_SIZE);
+    rom = &rom_copy[0];
+}
+
+//! Zeroed ROM to show until a cartridge is inserted.
+static cart_image_t *no_cart()
+{
+    static cart_image_t image;
+    return &image;
+}
+
+cartridge_t::cartridge_t()
+    : image(no_cart()), ram_enabled(false), rom_bank(1), ram_bank(0), mbc1_mode(false), rtc_latch(0xFF)
+{
+    memset(rtc, 0x00, sizeof(rtc));
+    memset(rtc_latched, 0x00, sizeof(rtc_latched));
+    memset(ram_dirty, 0x00, sizeof(ram_dirty));
+    memset(ram_changed, 0x00, sizeof(ram_changed));
+}
+
+//! Powers up with @param image_ inserted. Battery RAM starts out with the
+//! contents of the save file.
+void cartridge_t::insert(cart_image_t *image_)
+{
+    image = image_;
+    ram_enabled = (image->mbc == MBC_NONE);     // No enable register without an MBC
+    rom_bank = 1;
+    ram_bank = 0;
+    mbc1_mode = false;
+    memset(ram_dirty, 0x00, sizeof(ram_dirty));
+    const size_t ram_size = image->ram_banks * RAM_BANK_SIZE;
+    if(image->save_file.get())
+        memcpy(ram, image->save_file.get(), ram_size);
+    else
+        memset(ram, 0x00, ram_size);
+}
+
+//! MBC register write anywhere in 0x0000-0x7FFF.
+void cartridge_t::write(const uint16_t addr, const uint8_t val)
+{
+    switch(image->mbc)
+    {
+        case MBC_NONE:
+            return;
+
+        case MBC_1:
+            if(addr < 0x2000)       ram_enabled = (val & 0x0F) == 0x0A;
+            else if(addr < 0x4000)  rom_bank = (val & 0x1F) ? (val & 0x1F) : 0x01;
+            else if(addr < 0x6000)  ram_bank = val & 0x03;
+            else                    mbc1_mode = val & 0x01;
+            return;
+
+        case MBC_2:
+            if(addr >= 0x4000)
+                return;
+            // Address bit 8 selects between RAM enable and ROM bank
+            if(addr & 0x0100)       rom_bank = (val & 0x0F) ? (val & 0x0F) : 0x01;
+            else                    ram_enabled = (val & 0x0F) == 0x0A;
+            return;
+
+        case MBC_3:
+            if(addr < 0x2000)       ram_enabled = (val & 0x0F) == 0x0A;
+            else if(addr < 0x4000)  rom_bank = (val & 0x7F) ? (val & 0x7F) : 0x01;
+            else if(addr < 0x6000)  ram_bank = val;
+            else
+            {
+                if(rtc_latch == 0x00 && val == 0x01)
+                    memcpy(rtc_latched, rtc, sizeof(rtc));
+                rtc_latch = val;
+            }
+            return;
+
+        case MBC_5:
+            if(addr < 0x2000)       ram_enabled = (val & 0x0F) == 0x0A;
+            else if(addr < 0x3000)  rom_bank = (rom_bank & 0x100) | val;
+            else if(addr < 0x4000)  rom_bank = (rom_bank & 0x0FF) | ((val & 0x01) << 8);
+            else if(addr < 0x6000)  ram_bank = val & 0x0F;
+            return;
+    }
+}
+
+uint16_t cartridge_t::mbc1_upper() const
+{
+    return (image->mbc == MBC_1) ? (ram_bank << 5) : 0;
+}
+
+//! Bank mapped at 0x0000-0x3FFF. Only MBC1 in mode 1 ever moves it.
+const uint8_t *cartridge_t::rom0() const
+{
+    const uint16_t bank = mbc1_mode ? mbc1_upper() % image->rom_banks : 0;
+    return &image->rom[bank * ROM_BANK_SIZE];
+}
+
+//! Bank mapped at 0x4000-0x7FFF.
+const uint8_t *cartridge_t::romx() const
+{
+    const uint16_t bank = (rom_bank | mbc1_upper()) % image->rom_banks;
+    return &image->rom[bank * ROM_BANK_SIZE];
+}
+
+//! RAM bank visible at 0xA000-0xBFFF, or -1 when it isn't plain memory.
+int cartridge_t::ram_window_bank() const
+{
+    if(!ram_enabled || image->ram_banks == 0 || image->mbc == MBC_2)
+        return -1;
+    uint8_t bank = ram_bank;
+    if(image->mbc == MBC_1)
+        bank = mbc1_mode ? ram_bank : 0;
+    else if(image->mbc == MBC_3 && bank >= 0x08)
+        return -1;  // RTC register
+    return bank % image->ram_banks;
+}
+
+//! End of the RAM the inserted cartridge uses.
+const uint8_t *cartridge_t::ram_end() const
+{
+    return ram + image->ram_banks * RAM_BANK_SIZE;
+}
+
+//! RAM bank that can be mapped at 0xA000-0xBFFF directly, or null when
+//! accesses have to go through read_ram/write_ram.
+uint8_t *cartridge_t::ram_window()
+{
+    const int bank = ram_window_bank();
+    return bank < 0 ? 0 : &ram[bank * RAM_BANK_SIZE];
+}
+
+//! Whether writes to @param page (0x00-0x1F) of the RAM window may skip
+//! the cartridge: always without a battery, else once the page is dirty.
+bool cartridge_t::ram_page_writable(const uint8_t page) const
+{
+    const int bank = ram_window_bank();
+    if(bank < 0)
+        return false;
+    return !image->battery || ram_dirty[bank * (RAM_BANK_SIZE / RAM_PAGE_SIZE) + page];
+}
+
+void cartridge_t::ram_page_written(const uint8_t page)
+{
+    const int bank = ram_window_bank();
+    if(bank < 0)
+        return;
+    ram_dirty[bank * (RAM_BANK_SIZE / RAM_PAGE_SIZE) + page] = true;
+    ram_changed[bank * (RAM_BANK_SIZE / RAM_PAGE_SIZE) + page] = true;
+}
+
+//! Whether @param page (0x00-0x1F) of the RAM window was written since
+//! clear_changes().
+bool cartridge_t::ram_page_changed(const uint8_t page) const
+{
+    const int bank = ram_window_bank();
+    return bank >= 0 && ram_changed[bank * (RAM_BANK_SIZE / RAM_PAGE_SIZE) + page];
+}
+
+//! Same for the RAM page at host address @param page, -1 if that isn't
+//! cartridge RAM in use.
+int cartridge_t::ram_changed_at(const uint8_t *page) const
+{
+    if(page < ram || page >= ram_end())
+        return -1;
+    return ram_changed[(page - ram) / RAM_PAGE_SIZE];
+}
+
+void cartridge_t::clear_changes()
+{
+    memset(ram_changed, 0x00, sizeof(ram_changed));
+}
+
+//! Copies the RAM pages written since the last flush to the save file, one
+//! msync per run of adjacent dirty pages. With @param wait it blocks until
+//! the data is on disk, otherwise the kernel writes it back on its own.
+void cartridge_t::flush(const bool wait)
+{
+    uint8_t *save = image->save_file.get();
+    if(!save)
+        return;
+    const size_t pages = image->ram_banks * (RAM_BANK_SIZE / RAM_PAGE_SIZE);
+    for(size_t i = 0; i < pages; ++i)
+    {
+        if(!ram_dirty[i])
+            continue;
+        size_t end = i;
+        while(end < pages && ram_dirty[end])
+            ram_dirty[end++] = false;
+        const size_t offset = i * RAM_PAGE_SIZE, length = (end - i) * RAM_PAGE_SIZE;
+        memcpy(save + offset, ram + offset, length);
+        image->save_file.sync(offset, length, wait);
+        i = end;
+    }
+}
+
+//! Makes the next flush write all of the RAM, after it was replaced.
+void cartridge_t::mark_ram_dirty()
+{
+    const size_t pages = image->ram_banks * (RAM_BANK_SIZE / RAM_PAGE_SIZE);
+    if(image->battery)
+        std::fill(ram_dirty, ram_dirty + pages, true);
+    std::fill(ram_changed, ram_changed + pages, true);
+}
+
+uint8_t cartridge_t::read_ram(const uint16_t addr) const
+{
+    if(!ram_enabled)
+        return 0xFF;
+    if(image->mbc == MBC_2)
+        return 0xF0 | ram[addr & 0x01FF];
+    if(image->mbc == MBC_3 && ram_bank >= 0x08 && ram_bank <= 0x0C)
+        return rtc_latched[ram_bank - 0x08];
+    return 0xFF;
+}
+
+void cartridge_t::write_ram(const uint16_t addr, const uint8_t val)
+{
+    if(!ram_enabled)
+        return;
+    if(image->mbc == MBC_2)
+    {
+        ram[addr & 0x01FF] = val & 0x0F;
+        ram_dirty[(addr & 0x01FF) / RAM_PAGE_SIZE] = true;
+        ram_changed[(addr & 0x01FF) / RAM_PAGE_SIZE] = true;
+    }
+    else if(image->mbc == MBC_3 && ram_bank >= 0x08 && ram_bank <= 0x0C)
+        rtc[ram_bank - 0x08] = val;
+}
+
+void cartridge_t::save_state(state_writer_t &out) const
+{
+    // Identifies the cartridge, a state only loads into the same one
+    out.u16(image->rom_banks);
+    out.u8(image->ram_banks);
+    out.bytes(&image->rom[0x014D], 3);     // Header and global checksum
+
+    out.u16(rom_bank);
+    out.u8(ram_bank);
+    out.flag(ram_enabled);
+    out.flag(mbc1_mode);
+    out.bytes(rtc, sizeof(rtc));
+    out.bytes(rtc_latched, sizeof(rtc_latched));
+    out.u8(rtc_latch);
+    out.bytes(ram, image->ram_banks * RAM_BANK_SIZE);
+}
+
+//! Returns false, leaving everything untouched, if the state belongs to a
+//! different cartridge.
+bool cartridge_t::load_state(state_reader_t &in)
+{
+    uint8_t checksums[3];
+    const uint16_t banks = in.u16();
+    const uint8_t ram_banks_ = in.u8();
+    in.bytes(checksums, sizeof(checksums));
+    if(banks != image->rom_banks || ram_banks_ != image->ram_banks || memcmp(checksums, &image->rom[0x014D], 3) != 0)
+        return false;
+
+    rom_bank = in.u16();
+    ram_bank = in.u8();
+    ram_enabled = in.flag();
+    mbc1_mode = in.flag();
+    in.bytes(rtc, sizeof(rtc));
+    in.bytes(rtc_latched, sizeof(rtc_latched));
+    rtc_latch = in.u8();
+    in.bytes(ram, image->ram_banks * RAM_BANK_SIZE);
+    mark_ram_dirty();
+    return true;
+}
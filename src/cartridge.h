@@ -0,0 +1,104 @@
+#ifndef CARTRIDGE_H
+#define CARTRIDGE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdint.h>
+
+#include "mapped_file.h"
+#include "savestate.h"
+
+#define ROM_BANK_SIZE   0x4000
+#define RAM_BANK_SIZE   0x2000
+#define RAM_PAGE_SIZE   0x100
+#define RAM_MAX_BANKS   16
+#define RAM_MAX_PAGES   (RAM_MAX_BANKS * RAM_BANK_SIZE / RAM_PAGE_SIZE)
+
+typedef enum
+{
+	MBC_NONE,
+	MBC_1,
+	MBC_2,
+	MBC_3,
+	MBC_5
+} mbc_e;
+
+/*
+ * The read-only side of a cartridge: the ROM, what its header says and the
+ * .sav file next to it. The ROM is read straight from a shared read-only
+ * mapping of the file, only images that aren't a whole number of banks are
+ * copied. The boot ROM isn't part of the cartridge but is kept here too, it
+ * is the same kind of image. Every machine running the game, clones
+ * included, points at one cart_image_t that has to outlive them.
+ */
+class cart_image_t
+{
+	private:
+		std::shared_ptr<const mapped_file_t> rom_file;
+		std::vector<uint8_t> rom_copy;
+		void open_save(const std::string &rom_filename);
+
+	public:
+		const uint8_t *rom;
+		mbc_e mbc;
+		uint16_t rom_banks;
+		uint8_t ram_banks;
+		bool battery;
+		mapped_file_t save_file;    // Mapped if battery && ram_banks
+		uint8_t bootrom[0x100];
+
+		cart_image_t();
+		bool load(const std::string &filename);
+		bool load_bootrom(const std::string &filename);
+		void make_rom_writable();
+};
+
+/*
+ * The memory bank controller and cartridge RAM. Switching banks only changes
+ * which part of the image rom0()/romx()/ram_window() point at, membus_t maps
+ * those directly. RAM pages written since the last flush() are tracked, so
+ * only those get copied to the save file.
+ */
+class cartridge_t
+{
+	private:
+		cart_image_t *image;
+		bool ram_enabled;
+		uint16_t rom_bank;      // Bank register as written, see romx()
+		uint8_t ram_bank;       // RAM bank, or MBC1 upper ROM bits, or MBC3 RTC register
+		bool mbc1_mode;
+		uint8_t rtc[5];
+		uint8_t rtc_latched[5];
+		uint8_t rtc_latch;
+		bool ram_dirty[RAM_MAX_PAGES];      // Not in the save file yet
+		bool ram_changed[RAM_MAX_PAGES];    // Since clear_changes()
+		alignas(RAM_PAGE_SIZE) uint8_t ram[RAM_MAX_BANKS * RAM_BANK_SIZE];  // Last, only the used part is copied
+
+		uint16_t mbc1_upper() const;
+		int ram_window_bank() const;
+
+	public:
+		cartridge_t();
+		void insert(cart_image_t *image_);
+		const cart_image_t *get_image() const { return image; }
+		void make_rom_writable() { image->make_rom_writable(); }
+		void write(const uint16_t addr, const uint8_t val);
+		const uint8_t *rom0() const;
+		const uint8_t *romx() const;
+		uint8_t *ram_window();
+		const uint8_t *ram_end() const;
+		bool ram_page_writable(const uint8_t page) const;
+		bool ram_page_changed(const uint8_t page) const;
+		int ram_changed_at(const uint8_t *page) const;
+		void clear_changes();
+		void ram_page_written(const uint8_t page);
+		void flush(const bool wait);
+		void mark_ram_dirty();
+		uint8_t read_ram(const uint16_t addr) const;
+		void write_ram(const uint16_t addr, const uint8_t val);
+		void save_state(state_writer_t &out) const;
+		bool load_state(state_reader_t &in);
+};
+
+#endif
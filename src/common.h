@@ -7,4 +7,7 @@
 #define FLAG_I_LCDSTAT  0x02
 #define FLAG_I_VBLANK   0x01
 
+#define CPU_CLOCK_HZ        4194304
+#define CYCLES_PER_FRAME    70224   // 154 lines of 456 clocks
+
 #endif // COMMON_H
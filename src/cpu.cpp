@@ -2,8 +2,7 @@
 
 #include "common.h"
 
-#include <boost/thread.hpp>
-#include <boost/chrono/system_clocks.hpp>
+#include <algorithm>
 
 std::string binstring(const unsigned char byte);
 std::string binstring(const unsigned short bytes);
@@ -13,7 +12,7 @@ std::string cond_e_tostring(const cond_e cc);
 std::string alu_e_tostring(const alu_e alu);
 std::string rot_e_tostring(const rot_e rot);
 
-void cpu_t::init(membus_t *membus_, bool bootrom_enabled)
+void cpu_t::init(membus_t *membus_, scheduler_t *events_, bool bootrom_enabled)
 {
     last_instr.instr = 0x00;
     last_instr.data8 = 0x00;
@@ -24,7 +23,16 @@ void cpu_t::init(membus_t *membus_, bool bootrom_enabled)
     halted = false;
     IME = false;
     membus = membus_;
-    cycles_left = 0;
+    events = events_;
+    events->set_clock(&cycles);
+    cycles = 0;
+    overrun = 0;
+    has_breakpoint = false;
+    breakpoint = 0x0000;
+    resume_from_breakpoint = false;
+#ifdef BREAKPOINT
+    set_breakpoint(BREAKPOINT);
+#endif
     for(int i = 0; i < 6; ++i)  // To make valgrind happy, shouldn't be here.
         registers[i].r16 = 0x00;
     *get_reg(PC) = (bootrom_enabled ? 0x0000 : 0x0100);
@@ -35,21 +43,74 @@ void cpu_t::init(membus_t *membus_, bool bootrom_enabled)
 void cpu_t::run()
 {
     if(!panicked)
+        step();
+}
+
+//! Runs instructions until @param budget clock cycles have passed. The last
+//! instruction may run over the budget, the overrun is taken off the next call.
+run_result_e cpu_t::run_for(uint32_t budget)
+{
+    if(overrun >= budget)
+    {
+        overrun -= budget;
+        return RUN_BUDGET;
+    }
+
+    const bool check_breakpoint = has_breakpoint;
+    const reg16 bp = breakpoint;
+    const uint64_t end = cycles + (budget - overrun);
+
+    while(!panicked)
     {
-        using namespace boost::chrono;
-        typedef high_resolution_clock clock;
-        time_point<clock> const start = clock::now();
-        if(!halted && cycles_left == 0)
+        // Continuing after a breakpoint executes the instruction it is on
+        if(check_breakpoint && !halted && registers[PC].r16 == bp && !resume_from_breakpoint)
         {
-            id_execute();
+            overrun = 0;
+            resume_from_breakpoint = true;
+            return RUN_BREAKPOINT;
         }
-        if(cycles_left > 0) --cycles_left;
-        inc_counters();
-        check_interrupts();
+        resume_from_breakpoint = false;
+
+        // Nothing can wake a halted CPU before the next event fires.
+        if(halted && cycles < events->next())
+            cycles = std::min(events->next(), end);
+        else
+            step();
+        if(cycles >= end)
+        {
+            overrun = cycles - end;
+            return RUN_BUDGET;
+        }
+    }
+    overrun = 0;
+    return RUN_PANIC;
+}
 
-        nanoseconds nano_sleepy(microseconds(40) - (clock::now() - start));
-        //boost::this_thread::sleep_for(nano_sleepy);
+//! Fires due events, then executes a single instruction or idles for a
+//! machine cycle when halted. Interrupts can only become pending through an
+//! event, so they are only checked after one fired.
+void cpu_t::step()
+{
+    if(cycles >= events->next())
+    {
+        events->dispatch();
+        check_interrupts();
     }
+    if(halted)
+        cycle(4);
+    else
+        id_execute();
+}
+
+void cpu_t::set_breakpoint(reg16 adr)
+{
+    breakpoint = adr;
+    has_breakpoint = true;
+}
+
+void cpu_t::clear_breakpoint()
+{
+    has_breakpoint = false;
 }
 
 int8_t cpu_t::read_mem()
@@ -70,6 +131,7 @@ void cpu_t::check_interrupts()
     {
         IME = false;
         halted = false;
+        cycle(20);
         if(flags & FLAG_I_VBLANK)
         {
             //std::cout << "VBLANK" << std::endl;
@@ -79,95 +141,42 @@ void cpu_t::check_interrupts()
 
         if(flags & FLAG_I_LCDSTAT)
         {
+            #if DEBUG_OUTPUT > 0
             std::cout << "LCDSTAT" << std::endl;
+            #endif
             *IF &= ~FLAG_I_LCDSTAT;
             call(0x48);
         }
 
         if(flags & FLAG_I_TIMER)
         {
+            #if DEBUG_OUTPUT > 0
             std::cout << "TIMER" << std::endl;
+            #endif
             *IF &= ~FLAG_I_TIMER;
             call(0x50);
         }
 
         if(flags & FLAG_I_SERIAL)
         {
+            #if DEBUG_OUTPUT > 0
             std::cout << "SERIAL" << std::endl;
+            #endif
             *IF &= ~FLAG_I_SERIAL;
             call(0x58);
         }
 
         if(flags & FLAG_I_JOYPAD)
         {
+            #if DEBUG_OUTPUT > 0
             std::cout << "JOYPAD" << std::endl;
+            #endif
             *IF &= ~FLAG_I_JOYPAD;
             call(0x60);
         }
     }
 }
 
-void cpu_t::inc_counters()
-{
-    if(IME && (*IE & FLAG_I_VBLANK) && membus->read(0xFF44) == 0x90)
-    {
-        //std::cout << "VBLANK" << std::endl;
-        *IF |= FLAG_I_VBLANK;
-    }
-    if(membus->keypad_interrupt())
-    {
-        *IF |= FLAG_I_JOYPAD;
-    }
-}
-
-reg8 *cpu_t::get_reg(reg8_e reg)
-{
-    assert(reg != _HL_);
-    switch(reg)
-    {
-        case A:     return &(registers[AF].r8.h);
-        case F:     return &(registers[AF].r8.l);
-        case B:     return &(registers[BC].r8.h);
-        case C:     return &(registers[BC].r8.l);
-        case D:     return &(registers[DE].r8.h);
-        case E:     return &(registers[DE].r8.l);
-        case H:     return &(registers[HL].r8.h);
-        case L:     return &(registers[HL].r8.l);
-        default:    return 0x00;    // Crash!
-    }
-}
-
-reg16 *cpu_t::get_reg(reg16_e reg)
-{
-    switch(reg)
-    {
-        case AF:    return &(registers[AF].r16);
-        case BC:    return &(registers[BC].r16);
-        case DE:    return &(registers[DE].r16);
-        case HL:    return &(registers[HL].r16);
-        case SP:    return &(registers[SP].r16);
-        case PC:
-        default:    return &(registers[PC].r16);
-    }
-}
-
-reg8 cpu_t::read_reg(reg8_e reg)
-{
-    switch(reg)
-    {
-        case A:     return (registers[AF].r8.h);
-        case F:     return (registers[AF].r8.l);
-        case B:     return (registers[BC].r8.h);
-        case C:     return (registers[BC].r8.l);
-        case D:     return (registers[DE].r8.h);
-        case E:     return (registers[DE].r8.l);
-        case H:     return (registers[HL].r8.h);
-        case L:     return (registers[HL].r8.l);
-        case _HL_:  return membus->read(*get_reg(HL));
-        default:    return 0x00;    // Crash!
-    }
-}
-
 std::string reg8_e_tostring(const reg8_e r)
 {
     switch(r)
@@ -273,6 +282,37 @@ void cpu_t::print()
     }
 }
 
+void cpu_t::save_state(state_writer_t &out) const
+{
+    for(int i = 0; i < 6; ++i)
+        out.u16(registers[i].r16);
+    out.flag(IME);
+    out.flag(halted);
+    out.flag(booted);
+    out.flag(panicked);
+    out.u64(cycles);
+    out.u32(overrun);
+    out.u16(last_instr.adr);
+    out.u8(last_instr.instr);
+}
+
+void cpu_t::load_state(state_reader_t &in)
+{
+    for(int i = 0; i < 6; ++i)
+        registers[i].r16 = in.u16();
+    IME = in.flag();
+    halted = in.flag();
+    booted = in.flag();
+    panicked = in.flag();
+    cycles = in.u64();
+    overrun = in.u32();
+    last_instr.adr = in.u16();
+    last_instr.instr = in.u8();
+    last_instr.data8 = 0x00;
+    last_instr.data16.r16 = 0x0000;
+    resume_from_breakpoint = false;
+}
+
 void cpu_t::inject_code(uint8_t *code, size_t length, reg16 new_pc, int steps)
 {
     // Disable bootrom to make sure code is injected in ROM, not BOOTROM.
@@ -319,9 +359,9 @@ void cpu_t::panic()
     panicked = true;
 }
 
-void cpu_t::cycle(uint8_t n)
+void cpu_t::cycle(const uint8_t n)
 {
-    cycles_left = n;
+    cycles += n;
 }
 
 void cpu_t::set_flags(bool N, bool Z, bool H, bool C)
@@ -336,3 +376,8 @@ bool cpu_t::is_panicked() const
 {
     return panicked;
 }
+
+uint64_t cpu_t::get_cycles() const
+{
+    return cycles;
+}
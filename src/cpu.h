@@ -7,13 +7,24 @@
 #include <iostream>
 #include <iomanip>
 #include <string>
+#include <cassert>
 
 #define FLAG_Z  0x80
 #define FLAG_N  0x40
 #define FLAG_H  0x20
 #define FLAG_C  0x10
 
+// Opcode fields, see http://www.z80.info/decoding.htm
+#define GET_X(x)    ((x & 0xC0) >> 6)
+#define GET_Y(x)    ((x & 0x38) >> 3)
+#define GET_Z(x)    (x & 0x07)
+#define GET_P(x)    ((x & 0x30) >> 4)
+#define GET_Q(x)    ((x & 0x08) >> 3)
+
 #include "membus.h"
+#include "scheduler.h"
+#include "savestate.h"
+#include "rel_ptr.h"
 
 typedef uint8_t reg8;
 typedef uint16_t reg16;
@@ -100,20 +111,36 @@ typedef enum
 	SRL
 } rot_e;
 
+typedef enum
+{
+	RUN_BUDGET,     // Cycle budget used up
+	RUN_BREAKPOINT, // Stopped in front of the breakpoint
+	RUN_PANIC
+} run_result_e;
+
 class cpu_t
 {
 	private:
+	typedef void (cpu_t::*op_handler_t)();
+	static const op_handler_t base_ops[256];
+	static const op_handler_t cb_ops[256];
+
 	linstr_state_e last_instr;
 	bool booted;
 	bool panicked;
 	bool halted;
 	bool IME;
-	reg8 *IE;
-	reg8 *IF;
-	uint8_t cycles_left;
+	rel_ptr_t<reg8> IE;
+	rel_ptr_t<reg8> IF;
+	uint64_t cycles;    // Clock cycles since power on, only ever increases
+	uint32_t overrun;
+	bool has_breakpoint;
+	reg16 breakpoint;
+	bool resume_from_breakpoint;   // Last run_for() stopped at it, step over it once
 
 	reg16_2x8 registers[6];
-	membus_t *membus;
+	rel_ptr_t<membus_t> membus;
+	rel_ptr_t<scheduler_t> events;
 
 	reg8 *get_reg(const reg8_e reg);
 	reg16 *get_reg(const reg16_e reg);
@@ -128,14 +155,19 @@ class cpu_t
 	rot_e get_rot(const reg8 r);
 
 	void id_execute();
-	void id_execute_cb();
+	template<reg8 op> void op_base();
+	template<reg8 op> void op_cb();
+	void op_unknown();
+	reg8 fetch8();
+	reg16_2x8 fetch16();
 	void alu_exec(const alu_e op, const reg8 c);
 	void alu_exec(const alu_e op, const reg8_e reg);
 	void rot_exec(const rot_e op, const reg8_e reg);
 
 	int8_t read_mem();
+	void step();
+	bool test_cc(const cond_e c);
 	void check_interrupts();
-	void inc_counters();
 
 	void ld(const reg8_e dest, const reg8_e src);
 	void ld(const reg8_e dest, const reg8 src);
@@ -240,19 +272,54 @@ class cpu_t
 	void reti();
 
 	void panic();
-	void cycle(uint8_t n);
+	void cycle(const uint8_t n);
 
 	void set_flags(bool, bool, bool, bool);
 
 	public:
-	void init(membus_t *membus_, bool bootrom_enabled);
+	void init(membus_t *membus_, scheduler_t *events_, bool bootrom_enabled);
 	void run();
+	run_result_e run_for(uint32_t budget);
+	void set_breakpoint(reg16 adr);
+	void clear_breakpoint();
 	void inject_code(uint8_t *code, size_t length, reg16 new_pc, int steps = 0);
+	void save_state(state_writer_t &out) const;
+	void load_state(state_reader_t &in);
 
 	void print();
 	bool is_panicked() const;
+	uint64_t get_cycles() const;
 };
 
+inline reg8 *cpu_t::get_reg(const reg8_e reg)
+{
+	assert(reg != _HL_);
+	switch(reg)
+	{
+		case A:     return &(registers[AF].r8.h);
+		case F:     return &(registers[AF].r8.l);
+		case B:     return &(registers[BC].r8.h);
+		case C:     return &(registers[BC].r8.l);
+		case D:     return &(registers[DE].r8.h);
+		case E:     return &(registers[DE].r8.l);
+		case H:     return &(registers[HL].r8.h);
+		case L:     return &(registers[HL].r8.l);
+		default:    return 0x00;    // Crash!
+	}
+}
+
+inline reg16 *cpu_t::get_reg(const reg16_e reg)
+{
+	return &(registers[reg < PC ? reg : PC].r16);
+}
+
+inline reg8 cpu_t::read_reg(const reg8_e reg)
+{
+	if(reg == _HL_)
+		return membus->read(registers[HL].r16);
+	return *get_reg(reg);
+}
+
 #include "cpu_debug.h"
 
 #endif
@@ -17,12 +17,6 @@ std::string alu_e_tostring(const alu_e alu);
 std::string rot_e_tostring(const rot_e rot);
 void id_execute_cb(reg8 pc, reg8 instr, std::ostream &out);
 
-#define GET_X(x)    ((x & 0xC0) >> 6)
-#define GET_Y(x)    ((x & 0x38) >> 3)
-#define GET_Z(x)    (x & 0x07)
-#define GET_P(x)    ((x & 0x30) >> 4)
-#define GET_Q(x)    ((x & 0x08) >> 3)
-
 reg8_e get_r(const reg8 r)
 {
     switch(r)
@@ -0,0 +1,34 @@
+#include "frame_pacer.h"
+
+#include <thread>
+
+frame_pacer_t::frame_pacer_t()
+{
+    reset();
+}
+
+//! Starts counting frames from now.
+void frame_pacer_t::reset()
+{
+    base = clock::now();
+    frames = 0;
+}
+
+//! When frame @param n after base is due.
+frame_pacer_t::clock::time_point frame_pacer_t::deadline(const uint64_t n) const
+{
+    const std::chrono::duration<double> elapsed((double)n * CYCLES_PER_FRAME / CPU_CLOCK_HZ);
+    return base + std::chrono::duration_cast<clock::duration>(elapsed);
+}
+
+//! Sleeps until the next frame is due.
+void frame_pacer_t::wait()
+{
+    ++frames;
+    if(clock::now() > deadline(frames + PACER_MAX_LAG))
+    {
+        reset();
+        return;
+    }
+    std::this_thread::sleep_until(deadline(frames));
+}
@@ -0,0 +1,32 @@
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+#include <stdint.h>
+#include <chrono>
+
+#include "common.h"
+
+#define PACER_MAX_LAG   4       // Frames behind before the pacer gives up on them
+
+/*
+ * Holds a loop to the LCD's refresh rate, CYCLES_PER_FRAME cycles of
+ * CPU_CLOCK_HZ or about 59.73 Hz, on the steady clock. Deadlines are
+ * worked out from the frame count, so they don't drift with rounding.
+ * After a stall it starts over from the current time rather than running
+ * fast to make up for the lost frames.
+ */
+class frame_pacer_t
+{
+	private:
+		typedef std::chrono::steady_clock clock;
+		clock::time_point base;
+		uint64_t frames;        // Since base
+		clock::time_point deadline(const uint64_t n) const;
+
+	public:
+		frame_pacer_t();
+		void reset();
+		void wait();
+};
+
+#endif
@@ -0,0 +1,34 @@
+#include "frame_queue.h"
+
+#include <cstring>
+
+frame_queue_t::frame_queue_t()
+    : ready(1), filling(0), showing(2), published(0)
+{
+    memset(buffers, 0, sizeof(buffers));
+}
+
+//! Called by the emulation thread once @param screen is complete, with the
+//! @param vram, @param oam and @param lcd registers it was drawn from.
+void frame_queue_t::publish(const screen_t &screen, const uint8_t *vram, const uint8_t *oam, const uint8_t *lcd)
+{
+    frame_t &frame = buffers[filling];
+    memcpy(&frame.screen, &screen, sizeof(screen));
+    memcpy(frame.vram, vram, sizeof(frame.vram));
+    memcpy(frame.oam, oam, sizeof(frame.oam));
+    memcpy(frame.lcd, lcd, sizeof(frame.lcd));
+    frame.number = published++;
+
+    // The release makes the copies visible before the display can take them
+    filling = ready.exchange(filling | FRAME_FRESH, std::memory_order_acq_rel) & ~FRAME_FRESH;
+}
+
+//! Called by the display thread, makes the newest frame front(). False if
+//! nothing was published since the last call, front() stays as it was.
+bool frame_queue_t::take()
+{
+    if(!(ready.load(std::memory_order_relaxed) & FRAME_FRESH))
+        return false;
+    showing = ready.exchange(showing, std::memory_order_acq_rel) & ~FRAME_FRESH;
+    return true;
+}
@@ -0,0 +1,51 @@
+#ifndef FRAME_QUEUE_H
+#define FRAME_QUEUE_H
+
+#include <stdint.h>
+#include <atomic>
+
+#include "ppu.h"
+
+#define FRAME_BUFFERS   3
+#define FRAME_FRESH     0x04    // Set in frame_queue_t::ready until the display takes it
+
+/*
+ * A finished frame as the display thread gets it: the screen, and the
+ * VRAM, OAM and LCD registers it was drawn from for the debug views.
+ */
+struct frame_t
+{
+	screen_t screen;
+	uint8_t vram[0x2000];
+	uint8_t oam[0xA0];
+	uint8_t lcd[LCD_REGS];
+	uint64_t number;    // Frames published before this one
+};
+
+/*
+ * Hands finished frames from the emulation thread to the display thread
+ * without either of them waiting. Three buffers rotate: the one being
+ * filled, the newest finished one and the one on show. A display that
+ * falls behind only ever sees the latest frame, one that is ahead shows
+ * the same frame again.
+ */
+class frame_queue_t
+{
+	private:
+		frame_t buffers[FRAME_BUFFERS];
+		std::atomic<uint8_t> ready;     // Newest finished buffer, | FRAME_FRESH
+		uint8_t filling;                // Emulation thread only
+		uint8_t showing;                // Display thread only
+		uint64_t published;
+		frame_queue_t(const frame_queue_t&);
+		frame_queue_t &operator=(const frame_queue_t&);
+
+	public:
+		frame_queue_t();
+		void publish(const screen_t &screen, const uint8_t *vram, const uint8_t *oam, const uint8_t *lcd);
+		bool take();
+		//! The frame taken last, the display thread's until the next take().
+		const frame_t &front() const { return buffers[showing]; }
+};
+
+#endif
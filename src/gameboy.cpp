@@ -1,4 +1,6 @@
 #include "gameboy.h"
+#include "common.h"
+#include "frame_pacer.h"
 
 #include <boost/thread.hpp>
  
@@ -9,15 +11,57 @@ void gameboy_t::panic()
 }
 
 gameboy_t::gameboy_t(bool bootrom_enabled, std::string rom_filename)
-: panicked(false)
+: core(0), history(REWIND_BUFFER_SIZE, REWIND_INTERVAL), videodec(0), palette(builtin_palettes().front()),
+  stopping(false), panicked(false)
 {
 	if(bootrom_enabled)
-		bootrom_enabled = memory.open_bootrom();
-	if(!memory.open_rom(rom_filename))
+		bootrom_enabled = image.load_bootrom("boot_rom.bin");
+	if(!image.load(rom_filename))
 		std::cout << "GameROM not found\n";
 
-	cpu.init(&memory, bootrom_enabled);
-	videodec.init(&memory);
+	memset(screen.pixels, 0, sizeof(screen.pixels));
+	core = machine_t::create(&image, bootrom_enabled);
+	core->ppu.set_screen(&screen, &tile_cache);
+	core->ppu.set_output(&frames);
+	core->memory.set_keypad(&keypad);
+}
+
+gameboy_t::~gameboy_t()
+{
+	delete videodec;
+	core->memory.flush_save(true);
+	machine_t::destroy(core);
+}
+
+//! Runs the CPU for one frame worth of clock cycles.
+run_result_e gameboy_t::run_frame()
+{
+    core->memory.flush_save(false);
+    return core->run_frame();
+}
+
+size_t gameboy_t::save_state(uint8_t *buf, const size_t len) const
+{
+    return core->save_state(buf, len);
+}
+
+bool gameboy_t::load_state(const uint8_t *buf, const size_t len)
+{
+    return core->load_state(buf, len);
+}
+
+//! Copy of the running machine, a single memcpy. Release it with
+//! machine_t::destroy(). Call between frames.
+machine_t *gameboy_t::clone() const
+{
+    return core->clone();
+}
+
+//! Continues from a machine cloned from this one.
+void gameboy_t::restore(const machine_t &state)
+{
+    core->copy_from(state);
+    core->memory.mark_save_dirty();
 }
 
 void gameboy_t::run()
@@ -25,35 +69,86 @@ void gameboy_t::run()
     typedef boost::thread thread;
 
     struct cpu_runner_t {
-        cpu_runner_t(cpu_t& cpu_, membus_t& memory_)
-        : cpu(cpu_)
-        , memory(memory_)
+        cpu_runner_t(gameboy_t& gb_)
+        : gb(gb_)
         {}
 
-        cpu_t& cpu;
-        membus_t& memory;
+        gameboy_t& gb;
 
         void operator()(){
-            while(!(cpu.is_panicked() || memory.is_panicked())){
-                cpu.run();
+            // Emulated time runs at the real rate, the display repeats
+            // or skips frames to match its own refresh
+            frame_pacer_t pacer;
+            run_result_e result;
+            do{
+                uint32_t steps = gb.videodec->take_rewind_steps();
+                if(steps){
+                    while(steps-- && gb.history.step_back(*gb.core)){
+                    }
+                    result = RUN_BUDGET;
+                }
+                else{
+                    result = gb.run_frame();
+                    gb.history.push(*gb.core);
+                }
+                // Between frames, the machine is only ever read from here
+                if(gb.videodec->take_debug_request()){
+                    gb.core->cpu.print();
+                }
+                pacer.wait();
+            } while(result == RUN_BUDGET && !gb.stopping);
+            if(result == RUN_BREAKPOINT){
+                std::cout << "Breakpoint reached" << std::endl;
+                gb.core->cpu.print();
+            }
+            else if(result == RUN_PANIC){
+                throw std::runtime_error("CPU panicked");
             }
-            throw std::runtime_error("CPU panicked");
         }
     };
 
-    cpu_runner_t cpu_runner(cpu, memory);
+    videodec = new sdl_videodec_t();
+    videodec->init(&keypad, &frames);
+    videodec->set_palette(palette);
+
+    cpu_runner_t cpu_runner(*this);
     thread cpu_thread(cpu_runner);
 
-    while( !videodec.is_panicked() )
+    while( !videodec->is_panicked() )
     {
-        videodec.run();
-        if(videodec.requesting_debug()){
-            cpu.print();
+        if(!videodec->run()){
+            // Closed: return so that destruction saves the cartridge RAM
+            stopping = true;
+            cpu_thread.join();
+            return;
         }
     }
     throw std::runtime_error("Videodec panicked");
+}
 
-    cpu_thread.join();
+//! Colours for run() to show the screen in, it can be changed from there
+//! with P.
+void gameboy_t::set_palette(const palette_t &palette_)
+{
+    palette = palette_;
+}
+
+//! Runs @param frames frames as fast as possible without a display, or
+//! until the CPU stops when @param frames is 0.
+run_result_e gameboy_t::run_headless(const uint64_t frames)
+{
+    run_result_e result;
+    uint64_t n = 0;
+    do{
+        result = run_frame();
+    } while(result == RUN_BUDGET && (frames == 0 || ++n < frames));
+    return result;
+}
+
+//! The last frame drawn, complete between frames.
+const screen_t &gameboy_t::get_screen() const
+{
+    return screen;
 }
 
 bool gameboy_t::is_panicked()
@@ -1,24 +1,45 @@
 #ifndef GAMEBOY_H
 #define GAMEBOY_H
 
-#include "cpu.h"
-#include "membus.h"
+#include "machine.h"
+#include "cartridge.h"
+#include "rewind.h"
+#include "frame_queue.h"
 #include "sys/time.h"
 
 #include "sdl_videodec.h"
 
+#define REWIND_BUFFER_SIZE  (64 << 20)  // Bytes of history, about ten minutes
+#define REWIND_INTERVAL     1           // Frames per rewind step
+
 class gameboy_t
 {
 	private:
-	cpu_t cpu;
-	membus_t memory;
-	sdl_videodec_t videodec;
+	cart_image_t image;
+	screen_t screen;
+	tile_cache_t tile_cache;
+	frame_queue_t frames;       // Finished frames for the display thread
+	keypad_t keypad;            // Keys from the display thread
+	machine_t *core;
+	rewind_t history;
+	sdl_videodec_t *videodec;   // Only while run() shows the screen
+	palette_t palette;          // What run() starts showing the screen in
+	std::atomic<bool> stopping;     // Ends the CPU thread of run()
 	bool panicked;
 	void panic();
 
 	public:
 	gameboy_t(bool, std::string);
+	~gameboy_t();
 	void run();
+	void set_palette(const palette_t &palette_);
+	run_result_e run_headless(const uint64_t frames);
+	const screen_t &get_screen() const;
+	run_result_e run_frame();
+	size_t save_state(uint8_t *buf, const size_t len) const;
+	bool load_state(const uint8_t *buf, const size_t len);
+	machine_t *clone() const;
+	void restore(const machine_t &state);
 	bool is_panicked();
 };
 
@@ -353,7 +353,9 @@ void cpu_t::nop()
 
 void cpu_t::halt()
 {
+    #if DEBUG_OUTPUT > 0
     std::cout << "Halt" << std::endl;
+    #endif
     halted = true;
 }
 
@@ -365,14 +367,19 @@ void cpu_t::stop()
 
 void cpu_t::di()
 {
+    #if DEBUG_OUTPUT > 0
     std::cout << "DI" << std::endl;
+    #endif
     IME = false;
 }
 
 void cpu_t::ei()
 {
+    #if DEBUG_OUTPUT > 0
     std::cout << "EI" << std::endl;
+    #endif
     IME = true;
+    events->schedule(EV_IRQ, cycles);
 }
 
 void cpu_t::ld(const reg8_e dest, const reg8_e src)
@@ -857,19 +864,29 @@ void cpu_t::res(const reg8 b, const reg8_e src)
 #define C_NC    ((*get_reg(F) & FLAG_C) == 0x00)
 #define C_CC    ((*get_reg(F) & FLAG_C) == FLAG_C)
 
-void cpu_t::jp(const cond_e c, const uint16_t d)
+bool cpu_t::test_cc(const cond_e c)
 {
     switch(c)
     {
-        case NZ:    if(C_NZ)    jp(d);  return;
-        case Z:     if(C_Z)     jp(d);  return;
-        case NC:    if(C_NC)    jp(d);  return;
-        case CC:    if(C_CC)    jp(d);  return;
+        case NZ:    return C_NZ;
+        case Z:     return C_Z;
+        case NC:    return C_NC;
+        case CC:    return C_CC;
         case PO:
         case PE:
         case P:
         case M:
-        default:    panic();            return;
+        default:    panic();    return false;
+    }
+}
+
+// A taken conditional branch costs more than the not-taken base cost.
+void cpu_t::jp(const cond_e c, const uint16_t d)
+{
+    if(test_cc(c))
+    {
+        jp(d);
+        cycle(4);
     }
 }
 
@@ -885,17 +902,10 @@ void cpu_t::jphl()
 
 void cpu_t::jr(const cond_e c, const int8_t d)
 {
-    switch(c)
+    if(test_cc(c))
     {
-        case NZ:    if(C_NZ)    jr(d);  return;
-        case Z:     if(C_Z)     jr(d);  return;
-        case NC:    if(C_NC)    jr(d);  return;
-        case CC:    if(C_CC)    jr(d);  return;
-        case PO:
-        case PE:
-        case P:
-        case M:
-        default:    panic();            return;
+        jr(d);
+        cycle(4);
     }
 }
 
@@ -931,17 +941,10 @@ void cpu_t::call(const reg16 nn)
 
 void cpu_t::call(const cond_e c, const reg16 nn)
 {
-    switch(c)
+    if(test_cc(c))
     {
-        case NZ:    if(C_NZ)    call(nn);   return;
-        case Z:     if(C_Z)     call(nn);   return;
-        case NC:    if(C_NC)    call(nn);   return;
-        case CC:    if(C_CC)    call(nn);   return;
-        case PO:
-        case PE:
-        case P:
-        case M:
-        default:    panic();                return;
+        call(nn);
+        cycle(12);
     }
 }
 
@@ -958,17 +961,10 @@ void cpu_t::ret()
 
 void cpu_t::ret(const cond_e c)
 {
-    switch(c)
+    if(test_cc(c))
     {
-        case NZ:    if(C_NZ)    ret();  return;
-        case Z:     if(C_Z)     ret();  return;
-        case NC:    if(C_NC)    ret();  return;
-        case CC:    if(C_CC)    ret();  return;
-        case PO:
-        case PE:
-        case P:
-        case M:
-        default:    panic();            return;
+        ret();
+        cycle(12);
     }
 }
 
@@ -976,4 +972,5 @@ void cpu_t::reti()
 {
     ret();
     IME = true;
+    events->schedule(EV_IRQ, cycles);
 }
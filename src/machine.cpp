@@ -0,0 +1,137 @@
+#include "machine.h"
+#include "common.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+// clone() and copy_from() copy the block byte by byte. Nothing in it may
+// need a copy constructor: atomics and other shared state stay outside
+static_assert(std::is_trivially_copyable<cpu_t>::value && std::is_trivially_copyable<scheduler_t>::value
+              && std::is_trivially_copyable<ppu_t>::value && std::is_trivially_copyable<membus_t>::value,
+              "machine_t components have to be copyable with memcpy");
+
+//! Powers up a new machine with @param image inserted.
+machine_t *machine_t::create(cart_image_t *image, const bool bootrom_enabled)
+{
+    void *block;
+    if(posix_memalign(&block, alignof(machine_t), sizeof(machine_t)) != 0)
+        throw std::bad_alloc();
+    machine_t *m = new(block) machine_t();
+
+    m->events.set_handler(&machine_t::handle_event, m);
+    m->memory.attach(&m->events, &m->ppu);
+    m->memory.insert(image, bootrom_enabled);
+    m->cpu.init(&m->memory, &m->events, bootrom_enabled);
+    m->ppu.init(&m->memory, &m->events);
+    m->events.schedule(EV_PPU, 0);
+    return m;
+}
+
+void machine_t::destroy(machine_t *machine)
+{
+    if(!machine)
+        return;
+    machine->~machine_t();
+    free(machine);
+}
+
+//! A new machine in exactly this state. Call between frames. It has no
+//! screen, tile cache, frame output or keys: what it runs stays out of
+//! sight until the caller attaches its own.
+machine_t *machine_t::clone() const
+{
+    void *block;
+    if(posix_memalign(&block, alignof(machine_t), sizeof(machine_t)) != 0)
+        throw std::bad_alloc();
+    memcpy(block, this, size());
+    machine_t *m = static_cast<machine_t*>(block);
+    m->ppu.set_screen(0, 0);
+    m->ppu.set_output(0);
+    m->memory.set_keypad(0);
+    // A tile cache can't tell a new block from a freed one at the same
+    // address, so it has to start over whatever the parent had decoded
+    m->memory.mark_vram_dirty();
+    return m;
+}
+
+//! Puts this machine into the state of @param src, which has to run the
+//! same cartridge. The screen, tile cache, frame output and keys stay
+//! this machine's own.
+void machine_t::copy_from(const machine_t &src)
+{
+    screen_t *screen = ppu.get_screen();
+    tile_cache_t *tiles = ppu.get_tiles();
+    frame_queue_t *output = ppu.get_output();
+    keypad_t *keys = memory.get_keypad();
+    memcpy((void*)this, &src, src.size());
+    ppu.set_screen(screen, tiles);
+    ppu.set_output(output);
+    memory.set_keypad(keys);
+    memory.mark_vram_dirty();
+}
+
+//! Bytes a copy has to include: everything up to the end of the cartridge
+//! RAM actually in use, rounded up to a multiple of alignof(machine_t).
+size_t machine_t::size() const
+{
+    const size_t used = memory.end() - (const uint8_t*)this;
+    return (used + alignof(machine_t) - 1) & ~(alignof(machine_t) - 1);
+}
+
+void machine_t::handle_event(void *ctx, const event_e ev, const uint64_t when)
+{
+    machine_t *m = static_cast<machine_t*>(ctx);
+    switch(ev)
+    {
+        case EV_PPU:    m->ppu.update(when);                                break;
+        case EV_TIMER:  m->memory.timer_overflow(when);                     break;
+        case EV_SERIAL: m->memory.serial_done();                            break;
+        case EV_DMA:    m->memory.dma_done();                               break;
+        case EV_JOYPAD: m->memory.request_interrupt(FLAG_I_JOYPAD);         break;
+        case EV_IRQ:    /* The CPU checks interrupts after every dispatch */ break;
+        default:                                                            break;
+    }
+}
+
+//! Runs the CPU for one frame worth of clock cycles.
+run_result_e machine_t::run_frame()
+{
+    if(memory.is_panicked())
+        return RUN_PANIC;
+    memory.sync_input();
+    return cpu.run_for(CYCLES_PER_FRAME);
+}
+
+//! Writes the machine state to @param buf and returns its size. The state
+//! is only complete if that is no more than @param len, a call with an
+//! empty buffer gives the size to allocate once. Call between frames.
+size_t machine_t::save_state(uint8_t *buf, const size_t len) const
+{
+    state_writer_t out(buf, len);
+    out.u32(SAVESTATE_MAGIC);
+    out.u32(SAVESTATE_VERSION);
+    memory.save_state(out);
+    cpu.save_state(out);
+    events.save_state(out);
+    ppu.save_state(out);
+    return out.size();
+}
+
+//! Restores a state from save_state(). Returns false and leaves the machine
+//! as it was if the state is of another version, size or cartridge.
+bool machine_t::load_state(const uint8_t *buf, const size_t len)
+{
+    if(len != save_state(0, 0))
+        return false;
+    state_reader_t in(buf, len);
+    if(in.u32() != SAVESTATE_MAGIC || in.u32() != SAVESTATE_VERSION)
+        return false;
+    if(!memory.load_state(in))
+        return false;
+    cpu.load_state(in);
+    events.load_state(in);
+    ppu.load_state(in);
+    return in.good();
+}
@@ -0,0 +1,47 @@
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cpu.h"
+#include "membus.h"
+#include "scheduler.h"
+#include "ppu.h"
+#include "cartridge.h"
+#include "savestate.h"
+
+/*
+ * All state that changes while the emulated machine runs, in one block
+ * aligned to 256 bytes so memory pages line up with snapshot pages.
+ * Components refer to each other through rel_ptr_t offsets and page
+ * offsets instead of pointers, so copying the block is a complete clone.
+ * Read-only data (the cart_image_t) stays outside and is shared by all
+ * copies. Create with create() or clone(), release with destroy().
+ */
+class alignas(64) machine_t
+{
+	private:
+		static void handle_event(void *ctx, const event_e ev, const uint64_t when);
+		machine_t() {}
+		machine_t(const machine_t&);
+		machine_t &operator=(const machine_t&);
+
+	public:
+		cpu_t cpu;
+		scheduler_t events;
+		ppu_t ppu;
+		membus_t memory;    // Last, the unused tail of cartridge RAM isn't copied
+
+		static machine_t *create(cart_image_t *image, const bool bootrom_enabled);
+		static void destroy(machine_t *machine);
+		machine_t *clone() const;
+		void copy_from(const machine_t &src);
+		size_t size() const;
+
+		run_result_e run_frame();
+		size_t save_state(uint8_t *buf, const size_t len) const;
+		bool load_state(const uint8_t *buf, const size_t len);
+};
+
+#endif
@@ -1,16 +1,55 @@
 #include "gameboy.h"
 #include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
 #include <boost/filesystem.hpp>
 
 int main( int argc, char* argv[] )
 {
-    if(argc < 2){
-        std::cerr << "Usage: " << argv[0] << " <rom>" << std::endl;
+    // --headless <frames> runs without a display, for machines that have none.
+    // --palette takes a built in palette's name or four RRGGBB colours
+    uint64_t frames = 0;
+    bool headless = false;
+    palette_t palette = builtin_palettes().front();
+    bool usage = argc < 2;
+    for(int i = 1; i < argc - 1 && !usage; i += 2){
+        if(i + 2 >= argc)
+            usage = true;
+        else if(strcmp(argv[i], "--headless") == 0){
+            headless = true;
+            frames = strtoull(argv[i + 1], NULL, 10);
+        }
+        else if(strcmp(argv[i], "--palette") == 0){
+            if(!parse_palette(argv[i + 1], palette)){
+                std::cerr << "Unknown palette " << argv[i + 1] << std::endl;
+                usage = true;
+            }
+        }
+        else
+            usage = true;
+    }
+    if(usage){
+        std::cerr << "Usage: " << argv[0] << " [--headless <frames>] [--palette <name|c0,c1,c2,c3>] <rom>" << std::endl;
+        std::cerr << "Palettes:";
+        for(const palette_t &p : builtin_palettes())
+            std::cerr << " " << p.name;
+        std::cerr << std::endl;
         return -1;
     }
 
     bool const emulate_boot_rom = boost::filesystem::exists("boot_rom.bin");
-    gameboy_t gb(false, argv[1]);
+    gameboy_t gb(false, argv[argc - 1]);
+
+    if(headless){
+        auto start = std::chrono::steady_clock::now();
+        run_result_e result = gb.run_headless(frames);
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start);
+        std::cout << frames << " frames in " << elapsed.count() << " ms" << std::endl;
+        return result == RUN_BUDGET ? 0 : 1;
+    }
+    gb.set_palette(palette);
     gb.run();
 
     return 0;
@@ -0,0 +1,98 @@
+#include "mapped_file.h"
+
+#include <map>
+#include <mutex>
+#include <utility>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+mapped_file_t::mapped_file_t()
+    : data(0), size(0)
+{
+}
+
+mapped_file_t::~mapped_file_t()
+{
+    if(data)
+        munmap(data, size);
+}
+
+typedef std::pair<dev_t, ino_t> file_id_t;
+static std::map<file_id_t, std::weak_ptr<const mapped_file_t> > shared_files;
+static std::mutex shared_files_lock;
+
+//! Maps @param filename read-only, or returns the live mapping of the same
+//! file. Returns null if the file can't be opened or is empty.
+std::shared_ptr<const mapped_file_t> mapped_file_t::open_shared(const std::string &filename)
+{
+    std::shared_ptr<const mapped_file_t> file;
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+        return file;
+
+    struct stat st;
+    if(fstat(fd, &st) < 0 || st.st_size <= 0)
+    {
+        close(fd);
+        return file;
+    }
+
+    const file_id_t id(st.st_dev, st.st_ino);
+    std::lock_guard<std::mutex> lock(shared_files_lock);
+    file = shared_files[id].lock();
+    if(!file)
+    {
+        void *map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if(map != MAP_FAILED)
+        {
+            mapped_file_t *mapped = new mapped_file_t();
+            mapped->data = (uint8_t*)map;
+            mapped->size = st.st_size;
+            file.reset(mapped);
+            shared_files[id] = file;
+        }
+    }
+    close(fd);  // The mapping keeps its own reference
+    return file;
+}
+
+//! Maps the first @param length bytes of @param filename for reading and
+//! writing, creating the file or growing it with zeros as needed.
+bool mapped_file_t::open_writable(const std::string &filename, const size_t length)
+{
+    const int fd = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+    if(fd < 0)
+        return false;
+
+    struct stat st;
+    if(fstat(fd, &st) < 0 || ((size_t)st.st_size < length && ftruncate(fd, length) < 0))
+    {
+        close(fd);
+        return false;
+    }
+
+    void *map = mmap(0, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return false;
+
+    if(data)
+        munmap(data, size);
+    data = (uint8_t*)map;
+    size = length;
+    return true;
+}
+
+//! Writes back the range @param offset to @param offset + @param length.
+//! Without @param wait the write is only queued with the kernel.
+void mapped_file_t::sync(size_t offset, size_t length, const bool wait)
+{
+    static const size_t page_size = sysconf(_SC_PAGESIZE);
+    const size_t start = offset & ~(page_size - 1);
+    length += offset - start;
+    if(start + length > size)
+        length = size - start;
+    msync(data + start, length, wait ? MS_SYNC : MS_ASYNC);
+}
@@ -0,0 +1,35 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A file mapped into memory. Read-only images are shared: opening the same
+ * file again while a mapping is alive returns that mapping, and forked
+ * workers inherit it, so every instance reads the same physical pages.
+ * Writable mappings are private to their owner and reach the file through
+ * sync().
+ */
+class mapped_file_t
+{
+	private:
+		uint8_t *data;
+		size_t size;
+		mapped_file_t(const mapped_file_t&);
+		mapped_file_t &operator=(const mapped_file_t&);
+
+	public:
+		mapped_file_t();
+		~mapped_file_t();
+		static std::shared_ptr<const mapped_file_t> open_shared(const std::string &filename);
+		bool open_writable(const std::string &filename, const size_t length);
+		void sync(size_t offset, size_t length, const bool wait);
+		uint8_t *get() { return data; }
+		const uint8_t *get() const { return data; }
+		size_t length() const { return size; }
+};
+
+#endif
@@ -1,256 +1,505 @@
 #include "membus.h"
 #include "common.h"
 #include "cpu_debug.h"
+#include "ppu.h"
 
-#include <boost/chrono/system_clocks.hpp>
-
-#include <cmath>
 #include <cctype>
 #include <iostream>
 #include <iomanip>
 
 membus_t::membus_t()
-    : bootrom_enabled(false), panicked(false)
-{
-    int i;
-    memset(rom, 0x00, 0xFFFF);	// Zero memory, not completely correct...
-    memset(ram, 0x00, 0xFFFF);
-    cart_mode = rom + 0x0147;
-    rom_size = rom + 0x0148;
-    ram_size = rom + 0x0149;
-    mem_mode = 0x00;
-    rom_bank = 0x00;
-    for (i = 0; i < 8; ++i)
+    : tracking(false), ppu_log_used(0), bootrom_enabled(false), panicked(false), keys(0),
+      keypad_selected(false), div_base(0), tima_sync(0)
+{
+    memset(mem, 0x00, sizeof(mem));	// Zero memory, not completely correct...
+    memset(mem_written, 0x00, sizeof(mem_written));
+    mark_vram_dirty();
+    mem[0xFF00] = 0xCF;
+
+    update_banks();                                         // ROM and external RAM
+    map_ram();
+    map_pages(0xFF, 0x01, 0, 0);                            // I/O, HRAM and IE
+}
+
+//! Maps VRAM, WRAM and OAM. VRAM and OAM writes always go through
+//! write_handler, which brings the PPU up to date first and notes what the
+//! tile cache has to redo. While tracking writes, WRAM pages not written
+//! since start_tracking() only get mapped for reads, so the first write
+//! goes through write_handler and is noted there.
+void membus_t::map_ram()
+{
+    map_pages(0x80, 0x20, mem + 0x8000, 0);                 // VRAM
+    map_pages(0xC0, 0x20, mem + 0xC000, mem + 0xC000);      // WRAM
+    map_pages(0xE0, 0x1E, mem + 0xC000, mem + 0xC000);      // Echo of WRAM
+    map_pages(0xFE, 0x01, mem + 0xFE00, 0);                 // OAM
+    if(!tracking)
+        return;
+    for(uint16_t page = 0x80; page < 0xFF; ++page)
     {
-        key_states[i] = false;
+        const uint8_t mem_page = (page >= 0xE0 && page < 0xFE) ? page - 0x20 : page;
+        if(!mem_written[mem_page] && (page < 0xA0 || page >= 0xC0))
+            write_page[page - 0x80] = 0;
     }
-    keypad_handled = true;
 }
 
-bool membus_t::open_bootrom()
+//! Forgets which pages were written and starts noting writes again, see
+//! page_written().
+void membus_t::start_tracking()
 {
-    std::ifstream rom_in("boot_rom.bin", std::ios::in | std::ios::binary);
-    if(!rom_in.is_open())
-        return false;
+    tracking = true;
+    memset(mem_written, 0x00, sizeof(mem_written));
+    cart.clear_changes();
+    map_ram();
+    update_banks();
+}
 
-    rom_in.read((char*)bootrom, 0xFF);
-    rom_in.close();
-    bootrom_enabled = true;
+//! Whether the 256 byte @param page of this object was written since
+//! start_tracking(). Only VRAM, WRAM, OAM and cartridge RAM are tracked,
+//! -1 means anything else that has to be compared instead.
+int membus_t::page_written(const uint8_t *page) const
+{
+    if(page >= mem && page < mem + sizeof(mem))
+    {
+        const uint8_t mem_page = (page - mem) >> 8;
+        return mem_page == 0xFF ? -1 : mem_written[mem_page];
+    }
+    return cart.ram_changed_at(page);
+}
 
-    std::cout << "Loaded bootrom\n";
-    return true;
+//! Copies the VRAM changes since the last call to @param out and forgets
+//! them.
+void membus_t::take_vram_dirty(vram_dirty_t &out)
+{
+    out = vram_dirty;
+    memset(&vram_dirty, 0x00, sizeof(vram_dirty));
 }
 
-bool membus_t::open_rom(std::string filename)
+//! VRAM was replaced as a whole, every tile and map row is stale.
+void membus_t::mark_vram_dirty()
 {
-    std::ifstream::pos_type size;
-    std::ifstream rom_in(filename.c_str(),
-                         std::ios::in | std::ios::binary );
-    if(!rom_in.good())
-        return false;
+    memset(&vram_dirty, 0x01, sizeof(vram_dirty));
+}
+
+int32_t membus_t::offset_of(const uint8_t *p) const
+{
+    return p ? p - (const uint8_t*)this : 0;
+}
+
+//! Points @param count ROM pages starting at @param first to consecutive
+//! pages of @param base.
+void membus_t::map_rom(const uint8_t first, const uint8_t count, const uint8_t *base)
+{
+    for(uint8_t i = 0; i < count; ++i)
+        rom_page[first + i] = base + 0x100 * i;
+}
 
-    rom_in.seekg(0, std::ios::end);
-    size = rom_in.tellg();
-    if(size > 0x8000)
+//! Points @param count pages from 0x80 up, starting at @param first, to
+//! consecutive pages of @param base for reads and of @param writable for
+//! writes. Both have to be part of this object. Null leaves the access to
+//! read_handler/write_handler.
+void membus_t::map_pages(const uint8_t first, const uint16_t count, const uint8_t *base, uint8_t *writable)
+{
+    for(uint16_t i = 0; i < count; ++i)
     {
-        size = 0x8000;
-        std::cout << "Warning, rom bigger than 0x8000" << std::endl;
+        read_page[first - 0x80 + i] = base ? offset_of(base + 0x100 * i) : 0;
+        write_page[first - 0x80 + i] = writable ? offset_of(writable + 0x100 * i) : 0;
     }
-    rom_in.seekg(0, std::ios::beg);
-    if(!rom_in.read((char*)rom, size))
-        return false;
-    rom_in.close();
+}
 
-    char name[0x11];
-    strncpy(name, (char*)(rom + 0x134), 0x10);
-    std::cout << "Loaded rom " << name << "(size: " << (int)size << ", cart mode: " << (int)*cart_mode;
-    std::cout << ", rom size: " << (int)*rom_size << ", ram size: " << (int)*ram_size << ")" << std::endl;
+//! Remaps the cartridge windows after a bank switch. Nothing is copied,
+//! the pages just point into another part of the cartridge.
+void membus_t::update_banks()
+{
+    map_rom(0x00, 0x40, cart.rom0());
+    map_rom(0x40, 0x40, cart.romx());
+    uint8_t *ram = cart.ram_window();
+    map_pages(0xA0, 0x20, ram, 0);
+    for(uint8_t page = 0; ram && page < 0x20; ++page)
+    {
+        if(cart.ram_page_writable(page) && (!tracking || cart.ram_page_changed(page)))
+            write_page[0x20 + page] = offset_of(ram + page * RAM_PAGE_SIZE);
+    }
+    if(bootrom_enabled)
+        rom_page[0x00] = cart.get_image()->bootrom;
+}
 
+//! Powers up with @param image in the cartridge slot, starting in the boot
+//! ROM if @param bootrom_enabled.
+void membus_t::insert(cart_image_t *image, const bool bootrom_enabled_)
+{
+    cart.insert(image);
+    bootrom_enabled = bootrom_enabled_;
+    update_banks();
+}
 
+//! End of the state a copy of the machine has to include.
+const uint8_t *membus_t::end() const
+{
+    return cart.ram_end();
+}
 
-    return true;
+//! Hands cartridge RAM written since the last call to the save file.
+//! Called at frame boundaries, and with @param wait on exit.
+void membus_t::flush_save(const bool wait)
+{
+    cart.flush(wait);
+    update_banks();
 }
 
-//! Maps @param value to a range of [0, 1]
-//! Example to map 0-255 to 0-1: normalize(0, 255, 128)
-//! Example to map 1-10 to 0-1: normalize(1, 10, 3)
-template <typename T>
-T normalize(T const min, T const max, T const value){
-    return (value-min)/(max-min);
+//! The cartridge RAM was replaced as a whole, all of it needs saving.
+void membus_t::mark_save_dirty()
+{
+    cart.mark_ram_dirty();
+    update_banks();
 }
 
-//! Maps @param value to [@param min , @param max ]
-//! Example to map 0-1 to 0-255: normalize(0, 255, 0.5)
-//! Example to map 1-10 to 0-1: normalize(1, 10, 0.4)
-template <typename T>
-T denormalize(T const min, T const max, T const value){
-    return (value * (max-min) + min);
+void membus_t::save_state(state_writer_t &out) const
+{
+    cart.save_state(out);
+    out.bytes(mem + 0x8000, 0x2000);    // VRAM
+    out.bytes(mem + 0xC000, 0x2000);    // WRAM
+    out.bytes(mem + 0xFE00, 0x0200);    // OAM, I/O, HRAM and IE
+    out.flag(bootrom_enabled);
+    out.flag(keypad_selected);
+    out.flag(panicked);
+    out.u64(div_base);
+    out.u64(tima_sync);
 }
 
-uint8_t membus_t::read(const uint16_t addr)
+//! Fails without changing anything if the state is for another cartridge.
+bool membus_t::load_state(state_reader_t &in)
 {
-    /*if(addr == 0xFF00){
-        std::cout << "P1 (Joypad) read: " << std::hex << (int)rom[0xFF00] << std::endl;
-    }*/
-    if(addr == 0xFF01){
-        std::cout << "SB (Serial Bus) read unhandled" << std::endl;
-    }
-    if(addr == 0xFF02){
-        std::cout << "SC (Serial Control) read unhandled" << std::endl;
-    }
-    if(addr == 0xFF04){
-        std::cout << "DIV read unhandled" << std::endl;
-    }
-    if(addr == 0xFF05){
-        std::cout << "TIMA read unhandled" << std::endl;
-    }
-    if(addr == 0xFF06){
-        std::cout << "TMA read unhandled " << std::endl;
-    }
-    if(addr == 0xFF07){
-        std::cout << "TAC read unhandled " << std::endl;
-    }
-    if(addr == 0xFF24){
-        std::cout << "Sound channel control read unhandled " << std::endl;
-    }
-    if(addr == 0xFF25){
-        std::cout << "Sound channel selection read unhandled " << std::endl;
-    }
-    if(addr == 0xFF26){
-        std::cout << "Sound hardware control read unhandled " << std::endl;
-    }
-    if(addr == 0xFF41){
-        std::cout << "STAT read unhandled" << std::endl;
-    }
-    if(addr == 0xFF4A){
-        std::cout << "Read from WY register, unhandled" << std::endl;
-    }
-    if(addr == 0xFF4B){
-        std::cout << "Read from WX register, unhandled" << std::endl;
-    }
-    // Read the LY register, we calculate what would be in there (goes from 0x00 to 0x99 at 57Hz)
-    if(addr == 0xFF44){
-        static const bool increment_per_read = false;
-        uint8_t result = 0xA0;
-        if(!increment_per_read){
-            using namespace boost::chrono;
-            typedef high_resolution_clock clock;
-            nanoseconds const step = (nanoseconds(seconds(1))/57);
-            assert(step.count() > 0);
-            nanoseconds const now_duration = clock::now().time_since_epoch();
-
-            nanoseconds const part = now_duration % step;
-            double const normalized = normalize(0., double(step.count()), double(part.count()));
-            double const denormalized = denormalize(0., 152., normalized);
-            result = std::floor(denormalized);
-            //std::cout << now_duration.count() << " " << part.count() << " -> " << int(result) << std::endl;
-        } else {
-            result = rom[0xFF44] = (rom[0xFF44] + 1) % 0xA0;
-            //std::cout << int(result) << std::endl;
-        }
+    if(!cart.load_state(in))
+        return false;
+    in.bytes(mem + 0x8000, 0x2000);
+    in.bytes(mem + 0xC000, 0x2000);
+    in.bytes(mem + 0xFE00, 0x0200);
+    bootrom_enabled = in.flag();
+    keypad_selected = in.flag();
+    panicked = in.flag();
+    div_base = in.u64();
+    tima_sync = in.u64();
+    memset(mem_written, 0x01, sizeof(mem_written));
+    mark_vram_dirty();
+    ppu_log_used = 0;
+    map_ram();
+    update_banks();
+    return true;
+}
 
-        if(result == 0x90){
-            // If LY == 0x90, or IF
-            *get_pointer(0xFFFE) |= FLAG_I_VBLANK;
-        }
+void membus_t::attach(scheduler_t *events_, ppu_t *ppu_)
+{
+    events = events_;
+    ppu = ppu_;
+}
 
-        assert(result <= 0x99);
-        return result;
-    }
+//! Lets the PPU draw the lines it owes before VRAM or OAM change under it.
+inline void membus_t::sync_ppu()
+{
+    if(ppu)
+        ppu->catch_up(events->now());
+}
 
-    if(bootrom_enabled && addr < 0x100)
-    {
-        return bootrom[addr];
-    }
-    /*if(addr >= 0x4000 && *cart_mode == 0x01)
-    {
-        if(rom_bank == 0x00)
-            return rom[0x2000 + addr];
-        return rom[rom_bank * 0x2000 + addr];
-    }*/
-    return rom[addr];
+#define IO_NONE                 { 0x00, 0x00, 0xFF, IO_LOG_READ, IO_LOG_WRITE }
+#define IO_RW                   { 0xFF, 0xFF, 0x00, 0, 0 }
+#define IO_REG(r, w, u)         { r, w, u, 0, 0 }
+#define IO_CB(r, w, u, rd, wr)  { r, w, u, rd, wr }
+
+#ifdef LOG_IO
+#define IO_LOG_READ     &membus_t::io_log_read
+#define IO_LOG_WRITE    &membus_t::io_log_write
+#else
+#define IO_LOG_READ     0
+#define IO_LOG_WRITE    0
+#endif
+
+const membus_t::io_reg_t membus_t::io_regs[0x80] =
+{
+    /* FF00 P1   */ IO_CB(0x3F, 0x30, 0xC0, 0, &membus_t::write_p1),
+    /* FF01 SB   */ IO_RW,
+    /* FF02 SC   */ IO_CB(0x81, 0x81, 0x7E, 0, &membus_t::write_sc),
+    /* FF03      */ IO_NONE,
+    /* FF04 DIV  */ IO_CB(0xFF, 0xFF, 0x00, &membus_t::read_div, &membus_t::write_div),
+    /* FF05 TIMA */ IO_CB(0xFF, 0xFF, 0x00, &membus_t::read_tima, &membus_t::write_timer),
+    /* FF06 TMA  */ IO_CB(0xFF, 0xFF, 0x00, 0, &membus_t::write_timer),
+    /* FF07 TAC  */ IO_CB(0x07, 0x07, 0xF8, 0, &membus_t::write_timer),
+    /* FF08      */ IO_NONE, IO_NONE, IO_NONE, IO_NONE,
+    /* FF0C      */ IO_NONE, IO_NONE, IO_NONE,
+    /* FF0F IF   */ IO_CB(0x1F, 0x1F, 0xE0, 0, &membus_t::write_irq),
+
+    /* FF10 NR10 */ IO_REG(0x7F, 0xFF, 0x80),
+    /* FF11 NR11 */ IO_REG(0xC0, 0xFF, 0x3F),
+    /* FF12 NR12 */ IO_RW,
+    /* FF13 NR13 */ IO_REG(0x00, 0xFF, 0xFF),
+    /* FF14 NR14 */ IO_REG(0x40, 0xFF, 0xBF),
+    /* FF15      */ IO_NONE,
+    /* FF16 NR21 */ IO_REG(0xC0, 0xFF, 0x3F),
+    /* FF17 NR22 */ IO_RW,
+    /* FF18 NR23 */ IO_REG(0x00, 0xFF, 0xFF),
+    /* FF19 NR24 */ IO_REG(0x40, 0xFF, 0xBF),
+    /* FF1A NR30 */ IO_REG(0x80, 0xFF, 0x7F),
+    /* FF1B NR31 */ IO_REG(0x00, 0xFF, 0xFF),
+    /* FF1C NR32 */ IO_REG(0x60, 0xFF, 0x9F),
+    /* FF1D NR33 */ IO_REG(0x00, 0xFF, 0xFF),
+    /* FF1E NR34 */ IO_REG(0x40, 0xFF, 0xBF),
+    /* FF1F      */ IO_NONE,
+
+    /* FF20 NR41 */ IO_REG(0x00, 0xFF, 0xFF),
+    /* FF21 NR42 */ IO_RW,
+    /* FF22 NR43 */ IO_RW,
+    /* FF23 NR44 */ IO_REG(0x40, 0xFF, 0xBF),
+    /* FF24 NR50 */ IO_RW,
+    /* FF25 NR51 */ IO_RW,
+    /* FF26 NR52 */ IO_REG(0x80, 0x80, 0x70),
+    /* FF27      */ IO_NONE,
+    /* FF28      */ IO_NONE, IO_NONE, IO_NONE, IO_NONE,
+    /* FF2C      */ IO_NONE, IO_NONE, IO_NONE, IO_NONE,
+
+    /* FF30 Wave */ IO_RW, IO_RW, IO_RW, IO_RW, IO_RW, IO_RW, IO_RW, IO_RW,
+    /* FF38 Wave */ IO_RW, IO_RW, IO_RW, IO_RW, IO_RW, IO_RW, IO_RW, IO_RW,
+
+    /* FF40 LCDC */ IO_CB(0xFF, 0xFF, 0x00, 0, &membus_t::write_lcd),
+    /* FF41 STAT */ IO_CB(0x7F, 0x78, 0x80, &membus_t::read_lcd, &membus_t::write_lcd),
+    /* FF42 SCY  */ IO_CB(0xFF, 0xFF, 0x00, 0, &membus_t::write_ppu_reg),
+    /* FF43 SCX  */ IO_CB(0xFF, 0xFF, 0x00, 0, &membus_t::write_ppu_reg),
+    /* FF44 LY   */ IO_CB(0xFF, 0x00, 0x00, &membus_t::read_lcd, 0),
+    /* FF45 LYC  */ IO_CB(0xFF, 0xFF, 0x00, 0, &membus_t::write_lcd),
+    /* FF46 DMA  */ IO_CB(0xFF, 0xFF, 0x00, 0, &membus_t::write_dma),
+    /* FF47 BGP  */ IO_CB(0xFF, 0xFF, 0x00, 0, &membus_t::write_ppu_reg),
+    /* FF48 OBP0 */ IO_CB(0xFF, 0xFF, 0x00, 0, &membus_t::write_ppu_reg),
+    /* FF49 OBP1 */ IO_CB(0xFF, 0xFF, 0x00, 0, &membus_t::write_ppu_reg),
+    /* FF4A WY   */ IO_CB(0xFF, 0xFF, 0x00, 0, &membus_t::write_ppu_reg),
+    /* FF4B WX   */ IO_CB(0xFF, 0xFF, 0x00, 0, &membus_t::write_ppu_reg),
+    /* FF4C      */ IO_NONE, IO_NONE, IO_NONE, IO_NONE,
+
+    /* FF50 BOOT */ IO_CB(0x00, 0xFF, 0xFF, 0, &membus_t::write_boot),
+    /* FF51      */ IO_NONE, IO_NONE, IO_NONE, IO_NONE, IO_NONE, IO_NONE, IO_NONE,
+    /* FF58      */ IO_NONE, IO_NONE, IO_NONE, IO_NONE, IO_NONE, IO_NONE, IO_NONE, IO_NONE,
+    /* FF60      */ IO_NONE, IO_NONE, IO_NONE, IO_NONE, IO_NONE, IO_NONE, IO_NONE, IO_NONE,
+    /* FF68      */ IO_NONE, IO_NONE, IO_NONE, IO_NONE, IO_NONE, IO_NONE, IO_NONE, IO_NONE,
+    /* FF70      */ IO_NONE, IO_NONE, IO_NONE, IO_NONE, IO_NONE, IO_NONE, IO_NONE, IO_NONE,
+    /* FF78      */ IO_NONE, IO_NONE, IO_NONE, IO_NONE, IO_NONE, IO_NONE, IO_NONE, IO_NONE
+};
+
+//! Reads from pages without a direct mapping: cartridge RAM that is
+//! disabled or not plain memory, the I/O page and HRAM.
+uint8_t membus_t::read_handler(const uint16_t addr)
+{
+    if(addr >= 0xA000 && addr < 0xC000)
+        return cart.read_ram(addr);
+    if(addr >= 0xFF80)
+        return mem[addr];
+
+    const io_reg_t &io = io_regs[addr & 0x7F];
+    const uint8_t val = io.read ? (this->*io.read)(addr) : mem[addr];
+    return (val & io.read_mask) | (io.unused & ~io.read_mask);
 }
 
-void membus_t::write(const uint16_t addr, const uint8_t val)
+//! Writes to pages without a direct mapping: ROM (MBC control), unmapped
+//! cartridge RAM, VRAM, RAM pages not written since start_tracking(), the
+//! I/O page and HRAM.
+void membus_t::write_handler(const uint16_t addr, const uint8_t val)
 {
-    if(addr == 0xFF00){
-        if((val & 0x10) == 0x00)
+    if(addr < 0x8000)
+    {
+        cart.write(addr, val);
+        update_banks();
+        return;
+    }
+    if(addr >= 0xA000 && addr < 0xC000)
+    {
+        // First write to a RAM page since the last flush or snapshot: note
+        // it and map the page so further writes go straight through.
+        const uint8_t page = (addr >> 8) - 0xA0;
+        uint8_t *ram = cart.ram_window();
+        if(ram)
         {
-            //std::cout << "P1 (Joypad) selected direction keys" << std::endl;
-            keypad_select_direction();
+            cart.ram_page_written(page);
+            write_page[0x20 + page] = offset_of(ram + page * RAM_PAGE_SIZE);
+            ram[addr - 0xA000] = val;
         }
-        if((val & 0x20) == 0x00)
+        else
+            cart.write_ram(addr, val);
+        return;
+    }
+    if(addr < 0xA000)
+    {
+        // VRAM: note the tile or map row, unless nothing changes. Lines
+        // owed are drawn first, they take the dirty bits of the old bytes
+        if(mem[addr] == val)
+            return;
+        sync_ppu();
+        const uint16_t offset = addr - 0x8000;
+        if(offset < 0x1800)
+            vram_dirty.tiles[offset >> 4] = true;
+        else
+            vram_dirty.map_rows[(offset - 0x1800) >> 5] = true;
+        vram_dirty.any = true;
+        mem_written[addr >> 8] = true;
+        mem[addr] = val;
+        return;
+    }
+    if(addr < 0xFF00)
+    {
+        // OAM, or the first write to a WRAM page since start_tracking()
+        const uint8_t page = addr >> 8;
+        if(page == 0xFE)
         {
-            //std::cout << "P1 (Joypad) selected button keys" << std::endl;
-            keypad_select_buttons();
+            sync_ppu();
+            mem_written[0xFE] = true;
+            mem[addr] = val;
+            return;
         }
+        const uint16_t target = (page >= 0xE0 && page < 0xFE) ? addr - 0x2000 : addr;
+        mem_written[target >> 8] = true;
+        write_page[page - 0x80] = offset_of(mem + (target & 0xFF00));
+        mem[target] = val;
+        return;
     }
-    if(addr == 0xFF06){
-        std::cout << "TMA write unhandled " << std::hex << (int)val << std::endl;
-    }
-    if(addr == 0xFF07){
-        std::cout << "TAC write unhandled " << std::hex << (int)val << std::endl;
-    }
-    if(addr == 0xFF24){
-        //std::cout << "Sound channel control write unhandled " << std::hex << (int)val << std::endl;
-    }
-    if(addr == 0xFF25){
-        //std::cout << "Sound channel selection write unhandled " << std::hex << (int)val << std::endl;
-    }
-    if(addr == 0xFF26){
-        //std::cout << "Sound hardware control write unhandled " << std::hex << (int)val << std::endl;
-    }
-    if(addr == 0xFF40){
-        std::cout << "LCDC write " << std::hex << (unsigned int)val << std::endl;
-    }
-    if(addr == 0xFF41){
-        std::cout << "STAT write " << std::hex << (unsigned int)val << std::endl;
-    }
-    if(addr == 0xFF44){
-        std::cout << "Written to LY register, unhandled" << std::endl;
-    }
-    if(addr == 0xFF46){
-        //std::cout << "Written to DMA register: " << std::hex << (unsigned int)val << std::endl;
-        perform_dma(val);
-    }
-    if(addr == 0xFF4A){
-        std::cout << "Written to WY register, unhandled" << std::endl;
-    }
-    if(addr == 0xFF4B){
-        std::cout << "Written to WX register, unhandled" << std::endl;
-    }
-    if(addr == 0xFF0F){
-        std::cout << "IF write: " << std::hex << (unsigned int)val << std::endl;
-    }
-    if(addr == 0xFFFF){
-        std::cout << "IE write: " << std::hex << (unsigned int)val << std::endl;
-    }
-    if((addr == 0xFF02) && (val & 0x80) && std::isprint(rom[0xFF01])){
-        //std::cout << (char)rom[0xFF01] << std::flush;
-    }
-    if(addr >= 0x6000 && addr < 0x8000 && *cart_mode == 0x01)
+    if(addr >= 0xFF80)
     {
-        std::cout << "Memory mode write " << val << std::endl;
-        //mem_mode = val & 0x01;
-    }
+        mem[addr] = val;
+        if(addr == 0xFFFF)
+            events->schedule(EV_IRQ, events->now());
+        return;
+    }
+
+    const io_reg_t &io = io_regs[addr & 0x7F];
+    const uint8_t merged = (mem[addr] & ~io.write_mask) | (val & io.write_mask);
+    if(io.write)
+        (this->*io.write)(addr, merged);
+    else
+        mem[addr] = merged;
+}
 
-    if(addr >= 0x2000 && addr < 0x8000 && *cart_mode == 0x01)
+void membus_t::write_p1(const uint16_t addr, const uint8_t val)
+{
+    mem[addr] = val;
+    if((val & 0x10) == 0x00)
+    {
+        //std::cout << "P1 (Joypad) selected direction keys" << std::endl;
+        keypad_select_direction();
+    }
+    if((val & 0x20) == 0x00)
     {
-        std::cout << "Memory mode write " << val << std::endl;
-        //mem_mode = val & 0x01;
+        //std::cout << "P1 (Joypad) selected button keys" << std::endl;
+        keypad_select_buttons();
     }
+}
 
-    if(bootrom_enabled && addr == 0xFF50 && val == 0x01){
-        std::cout << "Disabling boot ROM." << std::endl;
-        bootrom_enabled = false;
+void membus_t::write_sc(const uint16_t addr, const uint8_t val)
+{
+    mem[addr] = val;
+    if((val & 0x80) && std::isprint(mem[0xFF01])){
+        //std::cout << (char)mem[0xFF01] << std::flush;
     }
-    //std::cout << "Write [" << std::hex << addr << "]=" << std::hex << (int)val << std::endl;
-    rom[addr] = val;
+    // Transfer with internal clock: 8 bits at 8192Hz, nobody on the other end.
+    if((val & 0x81) == 0x81){
+        events->schedule_in(EV_SERIAL, 8 * 512);
+    }
+}
+
+uint8_t membus_t::read_div(const uint16_t /*addr*/)
+{
+    return (events->now() - div_base) >> 8;
+}
+
+void membus_t::write_div(const uint16_t /*addr*/, const uint8_t /*val*/)
+{
+    timer_sync();
+    div_base = events->now();
+    timer_schedule();
+}
+
+uint8_t membus_t::read_tima(const uint16_t /*addr*/)
+{
+    return timer_tima();
+}
+
+void membus_t::write_timer(const uint16_t addr, const uint8_t val)
+{
+    timer_sync();
+    mem[addr] = val;
+    timer_schedule();
+}
+
+void membus_t::write_irq(const uint16_t addr, const uint8_t val)
+{
+    mem[addr] = val;
+    events->schedule(EV_IRQ, events->now());
+}
+
+//! STAT and LY are only worked out when read.
+uint8_t membus_t::read_lcd(const uint16_t addr)
+{
+    if(ppu)
+        ppu->sync(events->now());
+    return mem[addr];
+}
+
+//! LCDC, STAT and LYC: the PPU picks up the change right away.
+void membus_t::write_lcd(const uint16_t addr, const uint8_t val)
+{
+    if(addr == 0xFF40)
+        write_ppu_reg(addr, val);
+    else
+        mem[addr] = val;
+    events->schedule(EV_PPU, events->now());
+}
+
+//! Registers that change how lines look. The write is only logged with
+//! its cycle, the PPU applies it when it gets to the lines after it.
+void membus_t::write_ppu_reg(const uint16_t addr, const uint8_t val)
+{
+    if(ppu_log_used == PPU_LOG_SIZE)
+        sync_ppu();
+    ppu_write_t &w = ppu_log[ppu_log_used++];
+    w.when = events->now();
+    w.reg = addr - 0xFF40;
+    w.val = val;
+    mem[addr] = val;
+}
+
+void membus_t::write_dma(const uint16_t addr, const uint8_t val)
+{
+    mem[addr] = val;
+    perform_dma();
+}
+
+void membus_t::write_boot(const uint16_t /*addr*/, const uint8_t val)
+{
+    if(bootrom_enabled && val == 0x01)
+        disable_bootrom();
+}
+
+#ifdef LOG_IO
+uint8_t membus_t::io_log_read(const uint16_t addr)
+{
+    std::cout << "Unhandled I/O read 0x" << std::hex << addr << std::endl;
+    return 0xFF;
+}
+
+void membus_t::io_log_write(const uint16_t addr, const uint8_t val)
+{
+    std::cout << "Unhandled I/O write 0x" << std::hex << addr
+              << " = 0x" << (unsigned int)val << std::endl;
 }
+#endif
 
+//! Host pointer behind @param addr as currently mapped. Asking for ROM
+//! trades the shared image for a private copy that can be patched.
 uint8_t *membus_t::get_pointer(const uint16_t addr)
 {
-    return &rom[addr];
+    if(addr < 0x8000)
+    {
+        cart.make_rom_writable();
+        update_banks();
+        return const_cast<uint8_t*>(rom_page[addr >> 8]) + (addr & 0xFF);
+    }
+    const int32_t page = read_page[(addr >> 8) - 0x80];
+    if(page)
+        return (uint8_t*)this + page + (addr & 0xFF);
+    return &mem[addr];
 }
 
 void membus_t::panic()
@@ -267,24 +516,32 @@ void membus_t::enable_bootrom()
 {
     std::cout << "Enabling boot ROM.\n";
     bootrom_enabled = true;
+    rom_page[0x00] = cart.get_image()->bootrom;
 }
 
 void membus_t::disable_bootrom()
 {
     std::cout << "Disabling boot ROM.\n";
     bootrom_enabled = false;
+    rom_page[0x00] = cart.rom0();
 }
 
-void membus_t::set_keydown(jskey_t key)
+void keypad_t::set_keydown(jskey_t key)
 {
-    key_states[key] = true;
-    keypad_update();
+    pressed |= (1 << key);
+    changed = true;
 }
 
-void membus_t::set_keyup(jskey_t key)
+void keypad_t::set_keyup(jskey_t key)
 {
-    key_states[key] = false;
-    keypad_update();
+    pressed &= ~(1 << key);
+    changed = true;
+}
+
+//! Joypad reads come from @param keys_ from now on, 0 for no keys.
+void membus_t::set_keypad(keypad_t *keys_)
+{
+    keys = keys_;
 }
 
 void membus_t::keypad_select_buttons()
@@ -299,49 +556,102 @@ void membus_t::keypad_select_direction()
     keypad_update();
 }
 
+//! Picks up key changes from the UI thread. Called from the CPU thread.
+void membus_t::sync_input()
+{
+    if(keys && keys->changed.exchange(false))
+        keypad_update();
+}
+
 void membus_t::keypad_update()
 {
-    int i;
-    uint8_t mask = rom[0xFF00] | 0x0F;
+    const uint8_t held = keys ? keys->pressed.load() : 0;
+    uint8_t mask = mem[0xFF00] | 0x0F;
     if(keypad_selected)
     {
-        if(key_states[KEY_UP])    mask &= ~KEYMASK_UP;
-        if(key_states[KEY_LEFT])  mask &= ~KEYMASK_LEFT;
-        if(key_states[KEY_RIGHT]) mask &= ~KEYMASK_RIGHT;
-        if(key_states[KEY_DOWN])  mask &= ~KEYMASK_DOWN;
+        if(held & (1 << KEY_UP))    mask &= ~KEYMASK_UP;
+        if(held & (1 << KEY_LEFT))  mask &= ~KEYMASK_LEFT;
+        if(held & (1 << KEY_RIGHT)) mask &= ~KEYMASK_RIGHT;
+        if(held & (1 << KEY_DOWN))  mask &= ~KEYMASK_DOWN;
     } else {
-        if(key_states[KEY_A])      mask &= ~KEYMASK_A;
-        if(key_states[KEY_B])      mask &= ~KEYMASK_B;
-        if(key_states[KEY_START])  mask &= ~KEYMASK_START;
-        if(key_states[KEY_SELECT]) mask &= ~KEYMASK_SELECT;
+        if(held & (1 << KEY_A))      mask &= ~KEYMASK_A;
+        if(held & (1 << KEY_B))      mask &= ~KEYMASK_B;
+        if(held & (1 << KEY_START))  mask &= ~KEYMASK_START;
+        if(held & (1 << KEY_SELECT)) mask &= ~KEYMASK_SELECT;
     }
 
-    if ((mask & 0x0F) != 0x0F)
+    // The interrupt fires on a high to low transition of any input line.
+    if (mem[0xFF00] & ~mask & 0x0F)
     {
-        keypad_handled = false;
+        events->schedule(EV_JOYPAD, events->now());
     }
 
-    rom[0xFF00] = mask;
-    /*std::cout << "Keypad selected: " << keypad_selected << std::endl;
-    std::cout << "Key states: ";
-    for (i = 0; i < 8; ++i)
-    {
-        std::cout << key_states[i] << ", ";
-    }
-    std::cout << std::endl << "Keystate: " << std::hex << (int)rom[0xFF00] << std::endl;*/
+    mem[0xFF00] = mask;
+}
+
+void membus_t::request_interrupt(const uint8_t flag)
+{
+    mem[0xFF0F] |= flag;
+}
+
+static const uint16_t timer_periods[4] = { 1024, 16, 64, 256 };
+
+//! Current TIMA, counted from the DIV counter since the last sync.
+uint8_t membus_t::timer_tima() const
+{
+    if(!(mem[0xFF07] & 0x04))
+        return mem[0xFF05];
+    const uint16_t period = timer_periods[mem[0xFF07] & 0x03];
+    const uint64_t ticks = (events->now() - div_base) / period - (tima_sync - div_base) / period;
+    return mem[0xFF05] + ticks;
+}
+
+void membus_t::timer_sync()
+{
+    mem[0xFF05] = timer_tima();
+    tima_sync = events->now();
 }
 
-bool membus_t::keypad_interrupt()
+//! Schedules the next TIMA overflow. Call timer_sync() before changing any
+//! of the timer registers and this afterwards.
+void membus_t::timer_schedule()
 {
-    if (!keypad_handled)
+    if(!(mem[0xFF07] & 0x04))
     {
-        keypad_handled = true;
-        return true;
+        events->cancel(EV_TIMER);
+        return;
     }
-    return false;
+    const uint16_t period = timer_periods[mem[0xFF07] & 0x03];
+    const uint64_t tick = (tima_sync - div_base) / period + (0x100 - mem[0xFF05]);
+    events->schedule(EV_TIMER, div_base + tick * period);
+}
+
+void membus_t::timer_overflow(const uint64_t when)
+{
+    mem[0xFF05] = mem[0xFF06];
+    tima_sync = when;
+    request_interrupt(FLAG_I_TIMER);
+    timer_schedule();
+}
+
+void membus_t::serial_done()
+{
+    mem[0xFF01] = 0xFF;
+    mem[0xFF02] &= ~0x80;
+    request_interrupt(FLAG_I_SERIAL);
+}
+
+//! The transfer takes 160 machine cycles, OAM gets its data when it is done.
+void membus_t::perform_dma()
+{
+    events->schedule_in(EV_DMA, 640);
 }
 
-void membus_t::perform_dma(uint8_t addr)
+void membus_t::dma_done()
 {
-    memcpy(rom + 0xFE00, rom + addr * 0x100, 0x8C);
+    const uint16_t src = mem[0xFF46] << 8;
+    sync_ppu();
+    for(uint16_t i = 0; i < 0xA0; ++i)
+        mem[0xFE00 + i] = read(src + i);
+    mem_written[0xFE] = true;
 }
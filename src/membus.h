@@ -6,6 +6,14 @@
 #include <fstream>
 #include <iostream>
 #include <stdint.h>
+#include <atomic>
+
+#include "scheduler.h"
+#include "cartridge.h"
+#include "savestate.h"
+#include "rel_ptr.h"
+
+//#define LOG_IO
 
 #define KEYMASK_UP		0x04
 #define KEYMASK_LEFT	0x02
@@ -16,6 +24,29 @@
 #define KEYMASK_START	0x08
 #define KEYMASK_SELECT	0x04
 
+#define VRAM_TILES      384     // Tile slots in 0x8000-0x97FF
+#define VRAM_MAP_ROWS   64      // 32 rows in each of the two tile maps
+
+#define PPU_LOG_SIZE    128     // Register writes between two PPU catch-ups
+
+class ppu_t;
+
+//! A write to one of the LCD registers at 0xFF40-0xFF4B, at cycle when.
+struct ppu_write_t
+{
+	uint64_t when;
+	uint8_t reg;    // Offset from 0xFF40
+	uint8_t val;
+};
+
+//! What changed in VRAM since the tile cache last caught up.
+struct vram_dirty_t
+{
+	bool any;
+	bool tiles[VRAM_TILES];
+	bool map_rows[VRAM_MAP_ROWS];
+};
+
 typedef enum {
 	KEY_UP,
 	KEY_LEFT,
@@ -27,42 +58,144 @@ typedef enum {
 	KEY_SELECT
 } jskey_t;
 
+/*
+ * The keys held down, as the UI thread sets them. Input rather than machine
+ * state: like screen_t it stays outside machine_t, which is copied byte by
+ * byte. A clone of a machine starts without keys.
+ */
+struct keypad_t
+{
+	std::atomic<uint8_t> pressed;   // Bit per jskey_t
+	std::atomic<bool> changed;      // Taken by the CPU thread
+	keypad_t() : pressed(0), changed(false) {}
+	void set_keydown(jskey_t key);
+	void set_keyup(jskey_t key);
+};
+
 class membus_t
 {
 	private:
-		uint8_t rom[0xFFFF];
-		uint8_t ram[0xFFFF];
-		uint8_t bootrom[0xFF];
-		uint8_t *cart_mode;
-		uint8_t *rom_size;
-		uint8_t *ram_size;
-		uint8_t mem_mode;
-		uint8_t rom_bank;
+		typedef uint8_t (membus_t::*io_read_t)(const uint16_t addr);
+		typedef void (membus_t::*io_write_t)(const uint16_t addr, const uint8_t val);
+
+		//! Behaviour of one register in 0xFF00-0xFF7F. Bits outside read_mask
+		//! read as the matching bits of unused, bits outside write_mask keep
+		//! their value. Without callbacks the register is plain storage.
+		struct io_reg_t
+		{
+			uint8_t read_mask;
+			uint8_t write_mask;
+			uint8_t unused;
+			io_read_t read;
+			io_write_t write;
+		};
+		static const io_reg_t io_regs[0x80];
+
+		// ROM pages point into the shared cart_image_t. Pages from 0x8000 up
+		// are offsets from this object, so they stay valid in a copy of the
+		// machine. Offset 0 sends the access to read_handler/write_handler.
+		const uint8_t *rom_page[0x80];
+		int32_t read_page[0x80];
+		int32_t write_page[0x80];
+		alignas(0x100) uint8_t mem[0x10000];    // Pages line up with snapshot pages
+		bool tracking;
+		bool mem_written[0x100];    // Per page of mem while tracking
+		vram_dirty_t vram_dirty;
+		ppu_write_t ppu_log[PPU_LOG_SIZE];
+		uint16_t ppu_log_used;
+		rel_ptr_t<ppu_t> ppu;
 		bool bootrom_enabled;
 		bool panicked;
 		void panic();
-		bool key_states[8];
+		keypad_t *keys;         // Absolute, outside the machine. 0 for none
 		bool keypad_selected;
-		bool keypad_handled;
-		void perform_dma(const uint8_t addr);
+		rel_ptr_t<scheduler_t> events;
+		uint64_t div_base;
+		uint64_t tima_sync;
+		void map_rom(const uint8_t first, const uint8_t count, const uint8_t *base);
+		void map_pages(const uint8_t first, const uint16_t count, const uint8_t *base, uint8_t *writable);
+		int32_t offset_of(const uint8_t *p) const;
+		void map_ram();
+		void update_banks();
+		uint8_t read_handler(const uint16_t addr);
+		void write_handler(const uint16_t addr, const uint8_t val);
+		void perform_dma();
+		void write_p1(const uint16_t addr, const uint8_t val);
+		void write_sc(const uint16_t addr, const uint8_t val);
+		uint8_t read_div(const uint16_t addr);
+		void write_div(const uint16_t addr, const uint8_t val);
+		uint8_t read_tima(const uint16_t addr);
+		void write_timer(const uint16_t addr, const uint8_t val);
+		void write_irq(const uint16_t addr, const uint8_t val);
+		uint8_t read_lcd(const uint16_t addr);
+		void write_lcd(const uint16_t addr, const uint8_t val);
+		void write_ppu_reg(const uint16_t addr, const uint8_t val);
+		void sync_ppu();
+		void write_dma(const uint16_t addr, const uint8_t val);
+		void write_boot(const uint16_t addr, const uint8_t val);
+	#ifdef LOG_IO
+		uint8_t io_log_read(const uint16_t addr);
+		void io_log_write(const uint16_t addr, const uint8_t val);
+	#endif
+		uint8_t timer_tima() const;
+		void timer_sync();
+		void timer_schedule();
+		cartridge_t cart;       // Keep last, machine_t::size() counts on it
 
 	public:
 		membus_t();
-		bool open_bootrom();
-		bool open_rom(std::string filename);
-		uint8_t read(const uint16_t addr);
-		void write(const uint16_t addr, const uint8_t val);
+		void attach(scheduler_t *events_, ppu_t *ppu_);
+		void insert(cart_image_t *image, const bool bootrom_enabled);
+		void flush_save(const bool wait);
+		void mark_save_dirty();
+		void save_state(state_writer_t &out) const;
+		bool load_state(state_reader_t &in);
+		inline uint8_t read(const uint16_t addr);
+		inline void write(const uint16_t addr, const uint8_t val);
 		bool is_panicked();
 		void enable_bootrom();
 		void disable_bootrom();
 		uint8_t *get_pointer(const uint16_t addr);
+		const uint8_t *end() const;
+		void start_tracking();
+		int page_written(const uint8_t *page) const;
+		bool vram_changed() const { return vram_dirty.any; }
+		void take_vram_dirty(vram_dirty_t &out);
+		void mark_vram_dirty();
+		const ppu_write_t *ppu_writes() const { return ppu_log; }
+		uint16_t ppu_write_count() const { return ppu_log_used; }
+		void clear_ppu_writes() { ppu_log_used = 0; }
 
-		void set_keydown(jskey_t key);
-		void set_keyup(jskey_t key);
+		void set_keypad(keypad_t *keys_);
+		keypad_t *get_keypad() const { return keys; }
 		void keypad_select_buttons();
 		void keypad_select_direction();
 		void keypad_update();
-		bool keypad_interrupt();
+		void sync_input();
+
+		void request_interrupt(const uint8_t flag);
+		void timer_overflow(const uint64_t when);
+		void serial_done();
+		void dma_done();
 };
 
+inline uint8_t membus_t::read(const uint16_t addr)
+{
+	if(addr < 0x8000)
+		return rom_page[addr >> 8][addr & 0xFF];
+	const int32_t page = read_page[(addr >> 8) - 0x80];
+	if(page)
+		return ((const uint8_t*)this)[page + (addr & 0xFF)];
+	return read_handler(addr);
+}
+
+inline void membus_t::write(const uint16_t addr, const uint8_t val)
+{
+	const int32_t page = addr < 0x8000 ? 0 : write_page[(addr >> 8) - 0x80];
+	if(page)
+		((uint8_t*)this)[page + (addr & 0xFF)] = val;
+	else
+		write_handler(addr, val);
+}
+
 #endif
@@ -0,0 +1,125 @@
+#include "palette.h"
+
+#include <cstring>
+#include <cstdlib>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define PALETTE_X86
+#include <immintrin.h>
+#endif
+
+typedef void (*shade_convert_fn_t)(const uint8_t *shades, const uint32_t *lut, uint32_t *out, const size_t count);
+
+const std::vector<palette_t> &builtin_palettes()
+{
+    static const std::vector<palette_t> list = {
+        palette_t{"gray",   {0xFFFFFF, 0x808080, 0x606060, 0x202020}},
+        palette_t{"dmg",    {0x9BBC0F, 0x8BAC0F, 0x306230, 0x0F380F}},
+        palette_t{"pocket", {0xC4CFA1, 0x8B956D, 0x4D533C, 0x1F1F1F}},
+        palette_t{"linear", {0xFFFFFF, 0xAAAAAA, 0x555555, 0x000000}},
+    };
+    return list;
+}
+
+bool parse_palette(const char *spec, palette_t &out)
+{
+    for(const palette_t &p : builtin_palettes())
+    {
+        if(strcmp(spec, p.name) == 0)
+        {
+            out = p;
+            return true;
+        }
+    }
+
+    palette_t custom;
+    custom.name = "custom";
+    const char *s = spec;
+    for(int i = 0; i < PALETTE_SHADES; ++i)
+    {
+        char *end;
+        custom.rgb[i] = strtoul(s, &end, 16);
+        if(end - s != 6 || custom.rgb[i] > 0xFFFFFF)
+            return false;
+        if(*end != (i == PALETTE_SHADES - 1 ? '\0' : ','))
+            return false;
+        s = end + 1;
+    }
+    out = custom;
+    return true;
+}
+
+void palette_lut(const palette_t &palette, uint32_t *lut)
+{
+    for(int i = 0; i < PALETTE_SHADES; ++i)
+        lut[i] = (palette.rgb[i] << 8) | 0xFF;
+}
+
+static void convert_scalar(const uint8_t *shades, const uint32_t *lut, uint32_t *out, const size_t count)
+{
+    for(size_t i = 0; i < count; ++i)
+        out[i] = lut[shades[i] & 0x03];
+}
+
+#ifdef PALETTE_X86
+
+//! Four pixels per step: each shade is copied to the four bytes of its
+//! pixel and turned into byte offsets into the table, which one shuffle
+//! then looks up.
+__attribute__((target("ssse3")))
+static void convert_ssse3(const uint8_t *shades, const uint32_t *lut, uint32_t *out, const size_t count)
+{
+    const __m128i table = _mm_loadu_si128((const __m128i*)lut);
+    const __m128i spread = _mm_setr_epi8(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3);
+    const __m128i byte_n = _mm_setr_epi8(0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3);
+    const __m128i three = _mm_set1_epi8(3);
+
+    size_t i = 0;
+    for(; i + 4 <= count; i += 4)
+    {
+        int32_t four;
+        memcpy(&four, shades + i, 4);
+        __m128i idx = _mm_and_si128(_mm_shuffle_epi8(_mm_cvtsi32_si128(four), spread), three);
+        idx = _mm_add_epi8(_mm_slli_epi16(idx, 2), byte_n);
+        _mm_storeu_si128((__m128i*)(out + i), _mm_shuffle_epi8(table, idx));
+    }
+    convert_scalar(shades + i, lut, out + i, count - i);
+}
+
+//! Eight pixels per step, the shades widened to 32 bit lanes select
+//! whole pixels from the table.
+__attribute__((target("avx2")))
+static void convert_avx2(const uint8_t *shades, const uint32_t *lut, uint32_t *out, const size_t count)
+{
+    const __m256i table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)lut));
+    const __m256i three = _mm256_set1_epi32(3);
+
+    size_t i = 0;
+    for(; i + 8 <= count; i += 8)
+    {
+        const __m256i idx = _mm256_and_si256(
+            _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(shades + i))), three);
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_permutevar8x32_epi32(table, idx));
+    }
+    convert_scalar(shades + i, lut, out + i, count - i);
+}
+
+#endif /* PALETTE_X86 */
+
+static shade_convert_fn_t best_converter()
+{
+#ifdef PALETTE_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        return convert_avx2;
+    if(__builtin_cpu_supports("ssse3"))
+        return convert_ssse3;
+#endif
+    return convert_scalar;
+}
+
+void shades_to_rgba(const uint8_t *shades, const uint32_t *lut, uint32_t *out, const size_t count)
+{
+    static const shade_convert_fn_t best = best_converter();
+    best(shades, lut, out, count);
+}
@@ -0,0 +1,35 @@
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PALETTE_SHADES  4
+
+/*
+ * The colours the four LCD shades are shown in, lightest first. Only the
+ * display uses it; the PPU stops at shades.
+ */
+struct palette_t
+{
+	const char *name;
+	uint32_t rgb[PALETTE_SHADES];   // 0xRRGGBB
+};
+
+//! Palettes that can be picked by name, the first is the default.
+const std::vector<palette_t> &builtin_palettes();
+
+//! Parses @param spec into @param out: the name of a built in palette, or
+//! four RRGGBB colours separated by commas. False if it is neither.
+bool parse_palette(const char *spec, palette_t &out);
+
+//! RGBA8888 pixels of the shades of @param palette into @param lut.
+void palette_lut(const palette_t &palette, uint32_t *lut);
+
+//! Looks up @param count shades from @param shades in @param lut, which
+//! holds PALETTE_SHADES pixels, into @param out. Vectorized where the CPU
+//! can.
+void shades_to_rgba(const uint8_t *shades, const uint32_t *lut, uint32_t *out, const size_t count);
+
+#endif
@@ -0,0 +1,392 @@
+#include "ppu.h"
+#include "common.h"
+#include "frame_queue.h"
+
+#include <cstring>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+ppu_t::ppu_t()
+    : render_base(0), next_line(0), screen(0), tiles(0), output(0), frame_start(0), enabled(false),
+      stat_line(false), window_triggered(false), window_line(0)
+{
+}
+
+void ppu_t::init(membus_t *membus_, scheduler_t *events_)
+{
+    membus = membus_;
+    events = events_;
+    LCDC = membus->get_pointer(0xFF40);
+    STAT = membus->get_pointer(0xFF41);
+    LY = membus->get_pointer(0xFF44);
+    LYC = membus->get_pointer(0xFF45);
+    vram = membus->get_pointer(0x8000);
+    oam = membus->get_pointer(0xFE00);
+    lcd_io = membus->get_pointer(0xFF40);
+    load_registers();
+}
+
+//! Lines are drawn to @param screen_ from now on, from the tiles decoded
+//! in @param tiles_.
+void ppu_t::set_screen(screen_t *screen_, tile_cache_t *tiles_)
+{
+    screen = screen_;
+    tiles = tiles_;
+}
+
+//! Sets the copy of register @param reg to @param val, and the shades of
+//! its colour numbers if it is a palette.
+void ppu_t::write_register(const uint8_t reg, const uint8_t val)
+{
+    lcd[reg] = val;
+    if(reg >= LCD_BGP && reg <= LCD_OBP1)
+    {
+        for(int c = 0; c < 4; ++c)
+            shades[reg - LCD_BGP][c] = (val >> (2 * c)) & 0x03;
+    }
+}
+
+//! Takes all registers as the CPU sees them now.
+void ppu_t::load_registers()
+{
+    for(uint8_t reg = 0; reg < LCD_REGS; ++reg)
+        write_register(reg, lcd_io.get()[reg]);
+}
+
+//! Every finished frame is also copied to @param output_, 0 for none.
+void ppu_t::set_output(frame_queue_t *output_)
+{
+    output = output_;
+}
+
+//! Hands the screen as it is to the output, along with what it was drawn from.
+void ppu_t::publish()
+{
+    if(output && screen)
+        output->publish(*screen, vram.get(), oam.get(), lcd);
+}
+
+//! Raises the interrupts due at cycle @param when and schedules the next
+//! point where one could be: VBLANK, and the edges of whatever STAT
+//! interrupt sources are enabled. Without any of those enabled that is one
+//! event per frame, LY and STAT are brought up to date when they are read.
+//! Also scheduled right away when LCDC, STAT or LYC are written, so it has
+//! to be safe to call at any cycle.
+void ppu_t::update(const uint64_t when)
+{
+    if(!(*LCDC & LCDC_LCD_ENABLE))
+    {
+        if(enabled && screen)
+        {
+            memset(screen->pixels, 0, sizeof(screen->pixels));
+            publish();
+        }
+        membus->clear_ppu_writes();
+        enabled = false;
+        stat_line = false;
+        *LY = 0x00;
+        *STAT &= ~(STAT_MODE_MASK | STAT_COINCIDENCE);
+        return;
+    }
+    if(!enabled)
+    {
+        enabled = true;
+        frame_start = when;
+        render_base = when;
+        next_line = 0;
+        window_triggered = false;
+        window_line = 0;
+        load_registers();
+        membus->clear_ppu_writes();
+    }
+
+    // Compared against the frame still being drawn, so a VBLANK event
+    // replaced by an earlier register write isn't lost
+    const uint64_t vblank = render_base + PPU_VISIBLE_LINES * PPU_LINE_CYCLES;
+    if(when >= vblank)
+    {
+        membus->request_interrupt(FLAG_I_VBLANK);
+        catch_up(vblank);
+        publish();
+        render_base += CYCLES_PER_FRAME;
+        next_line = 0;
+        window_triggered = false;
+        window_line = 0;
+    }
+
+    sync(when);
+    const uint8_t mode = *STAT & STAT_MODE_MASK;
+    const bool line_high =
+           ((*STAT & STAT_COINCIDENCE) && (*STAT & STAT_INT_LYC))
+        || (mode == 0 && (*STAT & STAT_INT_HBLANK))
+        || (mode == 1 && (*STAT & STAT_INT_VBLANK))
+        || (mode == 2 && (*STAT & STAT_INT_OAM));
+    if(line_high && !stat_line)
+        membus->request_interrupt(FLAG_I_LCDSTAT);
+    stat_line = line_high;
+
+    const uint64_t next_vblank = render_base + PPU_VISIBLE_LINES * PPU_LINE_CYCLES;
+    const uint64_t next_stat = when + next_stat_change((when - frame_start) % CYCLES_PER_FRAME);
+    events->schedule(EV_PPU, next_stat < next_vblank ? next_stat : next_vblank);
+}
+
+//! Sets LY and the STAT mode and coincidence bits as they are at cycle
+//! @param when. Called when the CPU reads them.
+void ppu_t::sync(const uint64_t when)
+{
+    if(!enabled)
+        return;
+    const uint32_t t = (when - frame_start) % CYCLES_PER_FRAME;
+    const uint8_t line = t / PPU_LINE_CYCLES;
+    const uint16_t dot = t % PPU_LINE_CYCLES;
+    uint8_t mode;
+    if(line >= PPU_VISIBLE_LINES)
+        mode = 1;
+    else if(dot < PPU_OAM_CYCLES)
+        mode = 2;
+    else if(dot < PPU_OAM_CYCLES + PPU_TRANSFER_CYCLES)
+        mode = 3;
+    else
+        mode = 0;
+
+    *LY = line;
+    *STAT = (*STAT & ~(STAT_MODE_MASK | STAT_COINCIDENCE))
+          | (line == *LYC ? STAT_COINCIDENCE : 0x00) | mode;
+}
+
+//! Cycles from frame offset @param t to the next point where one of the
+//! enabled STAT interrupt sources turns on or off, at most a frame.
+uint32_t ppu_t::next_stat_change(const uint32_t t) const
+{
+    const uint32_t vblank = PPU_VISIBLE_LINES * PPU_LINE_CYCLES;
+    const uint32_t line_start = t - t % PPU_LINE_CYCLES;
+    const uint32_t dot = t % PPU_LINE_CYCLES;
+    uint32_t next = t + CYCLES_PER_FRAME;
+
+    if(*STAT & (STAT_INT_OAM | STAT_INT_HBLANK))
+    {
+        if(t >= vblank)
+            next = std::min<uint32_t>(next, CYCLES_PER_FRAME);
+        else
+        {
+            next = std::min<uint32_t>(next, line_start + PPU_LINE_CYCLES);
+            if((*STAT & STAT_INT_OAM) && dot < PPU_OAM_CYCLES)
+                next = std::min<uint32_t>(next, line_start + PPU_OAM_CYCLES);
+            if((*STAT & STAT_INT_HBLANK) && dot < PPU_OAM_CYCLES + PPU_TRANSFER_CYCLES)
+                next = std::min<uint32_t>(next, line_start + PPU_OAM_CYCLES + PPU_TRANSFER_CYCLES);
+        }
+    }
+    if((*STAT & STAT_INT_VBLANK) && t >= vblank)
+        next = std::min<uint32_t>(next, CYCLES_PER_FRAME);
+    if((*STAT & STAT_INT_LYC) && *LYC < PPU_LINES)
+    {
+        const uint32_t rise = *LYC * PPU_LINE_CYCLES;
+        const uint32_t fall = rise + PPU_LINE_CYCLES;
+        next = std::min<uint32_t>(next, t < rise ? rise : t < fall ? fall : CYCLES_PER_FRAME + rise);
+    }
+    return next - t;
+}
+
+//! Draws the lines whose HBLANK started by cycle @param when, each after
+//! the logged register writes up to that point. Whatever the log has left
+//! comes before the next line, so it is applied right away and the log
+//! starts over.
+void ppu_t::catch_up(const uint64_t when)
+{
+    const ppu_write_t *log = membus->ppu_writes();
+    const uint16_t used = membus->ppu_write_count();
+    uint16_t applied = 0;
+    while(enabled && next_line < SCREEN_H)
+    {
+        const uint64_t at = render_base + next_line * PPU_LINE_CYCLES
+                          + PPU_OAM_CYCLES + PPU_TRANSFER_CYCLES;
+        if(at > when)
+            break;
+        for(; applied < used && log[applied].when <= at; ++applied)
+            write_register(log[applied].reg, log[applied].val);
+        draw_line(next_line++);
+    }
+    for(; applied < used; ++applied)
+        write_register(log[applied].reg, log[applied].val);
+    membus->clear_ppu_writes();
+}
+
+//! Window bookkeeping for line @param line, and the line itself if there is
+//! a screen to draw to.
+void ppu_t::draw_line(const uint8_t line)
+{
+    // Once LY has matched WY the window shows for the rest of the frame,
+    // continuing with its own next line whenever it is enabled
+    if(line == lcd[LCD_WY])
+        window_triggered = true;
+    const bool window = window_triggered && lcd[LCD_WX] < SCREEN_W + 7
+                     && (lcd[LCD_LCDC] & (LCDC_WIN_ENABLE | LCDC_BG_ENABLE)) == (LCDC_WIN_ENABLE | LCDC_BG_ENABLE);
+    if(screen && tiles)
+        render_line(line, window);
+    window_line += window;
+}
+
+//! Draws screen line @param line, with the window over the background if
+//! @param window.
+void ppu_t::render_line(const uint8_t line, const bool window)
+{
+    uint8_t *out = screen->pixels[line];
+    uint8_t color[SCREEN_W];    // Colour numbers before the palette
+    tiles->update(*membus, vram.get(), lcd[LCD_LCDC] & LCDC_TILE_DATA);
+
+    if(lcd[LCD_LCDC] & LCDC_BG_ENABLE)
+    {
+        const uint8_t *row = tiles->plane_row((lcd[LCD_LCDC] & LCDC_BG_MAP) ? 1 : 0, line + lcd[LCD_SCY]);
+        const int x = lcd[LCD_SCX];
+        const int wrap = PLANE_SIZE - x;
+        if(wrap >= SCREEN_W)
+            memcpy(color, row + x, SCREEN_W);
+        else
+        {
+            memcpy(color, row + x, wrap);
+            memcpy(color + wrap, row, SCREEN_W - wrap);
+        }
+    }
+    else
+    {
+        memset(color, 0, SCREEN_W);
+    }
+
+    if(window)
+    {
+        const uint8_t *row = tiles->plane_row((lcd[LCD_LCDC] & LCDC_WIN_MAP) ? 1 : 0, window_line);
+        const int x = (lcd[LCD_WX] < 7) ? 0 : lcd[LCD_WX] - 7;
+        memcpy(color + x, row + x + 7 - lcd[LCD_WX], SCREEN_W - x);
+    }
+
+    const uint8_t *bgp = shades[PAL_BGP];
+    for(int i = 0; i < SCREEN_W; ++i)
+        out[i] = bgp[color[i]];
+
+    if(lcd[LCD_LCDC] & LCDC_OBJ_ENABLE)
+        render_sprites(line, color, out);
+}
+
+//! Up to PPU_LINE_SPRITES OAM entries that cover @param line, in OAM order,
+//! into @param selected. Returns how many there are. The Y compare is done
+//! for sixteen bytes of OAM at a time, only every fourth lane is a Y.
+int ppu_t::select_sprites(const uint8_t line, uint8_t *selected) const
+{
+    const uint8_t height = (lcd[LCD_LCDC] & LCDC_OBJ_SIZE) ? 16 : 8;
+    uint64_t hits = 0;  // Bit per OAM entry
+#ifdef __SSE2__
+    const __m128i top = _mm_set1_epi8(line + 16);
+    const __m128i last = _mm_set1_epi8(height - 1);
+    for(int chunk = 0; chunk < OAM_ENTRIES / 4; ++chunk)
+    {
+        const __m128i y = _mm_loadu_si128((const __m128i*)(oam.get() + 16 * chunk));
+        const __m128i row = _mm_sub_epi8(top, y);
+        const int in = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(row, last), row)) & 0x1111;
+        hits |= (uint64_t)((in | (in >> 3) | (in >> 6) | (in >> 9)) & 0x0F) << (4 * chunk);
+    }
+#else
+    for(int n = 0; n < OAM_ENTRIES; ++n)
+    {
+        if((uint8_t)(line + 16 - oam.get()[4 * n]) < height)
+            hits |= (uint64_t)1 << n;
+    }
+#endif
+    int count = 0;
+    for(; hits && count < PPU_LINE_SPRITES; hits &= hits - 1)
+        selected[count++] = __builtin_ctzll(hits);
+    return count;
+}
+
+//! Draws the sprites on @param line over @param out, which holds the shades
+//! of the background colour numbers in @param bg.
+void ppu_t::render_sprites(const uint8_t line, const uint8_t *bg, uint8_t *out)
+{
+    uint8_t selected[PPU_LINE_SPRITES];
+    const int count = select_sprites(line, selected);
+    if(!count)
+        return;
+
+    // The lower X wins where sprites overlap, then the lower OAM entry
+    for(int i = 1; i < count; ++i)
+    {
+        const uint8_t n = selected[i];
+        int j = i;
+        for(; j > 0 && oam.get()[4 * selected[j - 1] + 1] > oam.get()[4 * n + 1]; --j)
+            selected[j] = selected[j - 1];
+        selected[j] = n;
+    }
+
+    // Each pixel goes to the first sprite with a colour there, even when
+    // that one is hidden behind the background
+    uint8_t obj_px[256 + 8];    // By OAM X, screen x 0 is at 8
+    uint8_t obj_shade[256 + 8];
+    uint8_t obj_behind[256 + 8];
+    memset(obj_px, 0, sizeof(obj_px));
+    const bool tall = lcd[LCD_LCDC] & LCDC_OBJ_SIZE;
+    for(int i = 0; i < count; ++i)
+    {
+        const uint8_t *obj = oam.get() + 4 * selected[i];
+        const uint8_t attr = obj[3];
+        uint8_t row = line + 16 - obj[0];
+        if(attr & OAM_YFLIP)
+            row = (tall ? 15 : 7) - row;
+        const uint16_t tile_n = tall ? ((obj[2] & 0xFE) | (row >> 3)) : obj[2];
+        const uint8_t *px = tiles->tile(tile_n, attr & OAM_XFLIP) + 8 * (row & 7);
+        const uint8_t *palette = shades[(attr & OAM_PALETTE) ? PAL_OBP1 : PAL_OBP0];
+        for(int k = 0; k < 8; ++k)
+        {
+            const int x = obj[1] + k;
+            if(px[k] && !obj_px[x])
+            {
+                obj_px[x] = px[k];
+                obj_shade[x] = palette[px[k]];
+                obj_behind[x] = attr & OAM_BEHIND_BG;
+            }
+        }
+    }
+
+    for(int x = 0; x < SCREEN_W; ++x)
+    {
+        const bool show = obj_px[x + 8] && !(obj_behind[x + 8] && bg[x]);
+        const uint8_t mask = -(uint8_t)show;
+        out[x] = (obj_shade[x + 8] & mask) | (out[x] & ~mask);
+    }
+}
+
+//! After loading a state: drawing goes on from the current line with the
+//! registers as they are now. Lines already past stay as they were drawn.
+void ppu_t::resync()
+{
+    // render_base is ahead of now during VBLANK, and behind by more than
+    // the visible lines if the VBLANK event is still due
+    const uint64_t now = events->now();
+    const uint64_t first = render_base + PPU_OAM_CYCLES + PPU_TRANSFER_CYCLES;
+    next_line = 0;
+    if(now >= first)
+        next_line = std::min<uint64_t>(SCREEN_H, (now - first) / PPU_LINE_CYCLES + 1);
+    load_registers();
+    membus->clear_ppu_writes();
+}
+
+void ppu_t::save_state(state_writer_t &out) const
+{
+    out.u64(frame_start);
+    out.u64(render_base);
+    out.flag(enabled);
+    out.flag(stat_line);
+    out.flag(window_triggered);
+    out.u8(window_line);
+}
+
+void ppu_t::load_state(state_reader_t &in)
+{
+    frame_start = in.u64();
+    render_base = in.u64();
+    enabled = in.flag();
+    stat_line = in.flag();
+    window_triggered = in.flag();
+    window_line = in.u8();
+    resync();
+}
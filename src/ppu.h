@@ -0,0 +1,137 @@
+#ifndef PPU_H
+#define PPU_H
+
+#include <stdint.h>
+
+#include "membus.h"
+#include "scheduler.h"
+#include "savestate.h"
+#include "rel_ptr.h"
+#include "tile_cache.h"
+
+class frame_queue_t;
+
+#define PPU_LINE_CYCLES     456
+#define PPU_OAM_CYCLES      80      // Mode 2
+#define PPU_TRANSFER_CYCLES 172     // Mode 3, the rest of the line is HBLANK
+#define PPU_VISIBLE_LINES   144
+#define PPU_LINES           154
+
+#define SCREEN_W            160
+#define SCREEN_H            PPU_VISIBLE_LINES
+
+#define STAT_MODE_MASK      0x03
+#define STAT_COINCIDENCE    0x04
+#define STAT_INT_HBLANK     0x08
+#define STAT_INT_VBLANK     0x10
+#define STAT_INT_OAM        0x20
+#define STAT_INT_LYC        0x40
+
+#define LCDC_BG_ENABLE      0x01
+#define LCDC_OBJ_ENABLE     0x02
+#define LCDC_OBJ_SIZE       0x04
+#define LCDC_BG_MAP         0x08
+#define LCDC_TILE_DATA      0x10
+#define LCDC_WIN_ENABLE     0x20
+#define LCDC_WIN_MAP        0x40
+#define LCDC_LCD_ENABLE     0x80
+
+//! LCD registers from 0xFF40, as ppu_write_t::reg numbers them
+typedef enum {
+	LCD_LCDC,
+	LCD_STAT,
+	LCD_SCY,
+	LCD_SCX,
+	LCD_LY,
+	LCD_LYC,
+	LCD_DMA,
+	LCD_BGP,
+	LCD_OBP0,
+	LCD_OBP1,
+	LCD_WY,
+	LCD_WX,
+	LCD_REGS
+} lcd_reg_e;
+
+#define OAM_ENTRIES         40
+#define OAM_PALETTE         0x10
+#define OAM_XFLIP           0x20
+#define OAM_YFLIP           0x40
+#define OAM_BEHIND_BG       0x80
+#define PPU_LINE_SPRITES    10      // The rest of a line's sprites are dropped
+#define PPU_PALETTES        3       // BGP, OBP0 and OBP1, in register order
+#define PAL_BGP             0       // Index in ppu_t::shades, the register minus LCD_BGP
+#define PAL_OBP0            1
+#define PAL_OBP1            2
+
+/*
+ * What the LCD shows, one shade (0-3, palette already applied) per pixel.
+ * Not part of the machine state: it stays outside machine_t. A clone of a
+ * machine starts without a screen and only draws once it is given one.
+ */
+struct screen_t
+{
+	uint8_t pixels[SCREEN_H][SCREEN_W];
+};
+
+/*
+ * LCD timing and rendering. LY, the STAT mode and the VBLANK/LCDSTAT
+ * interrupts follow the emulated cycle counter, but nothing runs per line:
+ * events are only scheduled where an interrupt can be raised, and LY and
+ * STAT are worked out from the cycle when the CPU reads them. Lines are
+ * drawn in batches, at VBLANK and whenever VRAM or OAM is about to change.
+ * Each looks as it would have when its HBLANK started: register writes
+ * come from membus_t's log with their cycle and are replayed onto a copy
+ * of the registers in between lines. Finished frames can be copied out
+ * to a frame_queue_t for another thread to show.
+ */
+class ppu_t
+{
+	private:
+		rel_ptr_t<membus_t> membus;
+		rel_ptr_t<scheduler_t> events;
+		rel_ptr_t<uint8_t> LCDC;
+		rel_ptr_t<uint8_t> STAT;
+		rel_ptr_t<uint8_t> LY;
+		rel_ptr_t<uint8_t> LYC;
+		rel_ptr_t<const uint8_t> vram;
+		rel_ptr_t<const uint8_t> oam;
+		rel_ptr_t<const uint8_t> lcd_io;    // The registers the CPU sees
+		uint8_t lcd[LCD_REGS];      // The registers the next line is drawn with
+		uint8_t shades[PPU_PALETTES][4];    // Colour number to shade, from lcd[]
+		uint64_t render_base;       // Cycle at which LY 0 of the frame being drawn starts
+		uint8_t next_line;          // SCREEN_H once the frame is complete
+		screen_t *screen;       // Absolute, outside the machine. 0 draws nothing
+		tile_cache_t *tiles;    // Same
+		frame_queue_t *output;  // Same, gets every finished frame. 0 for none
+		uint64_t frame_start;   // Cycle at which LY 0 started
+		bool enabled;
+		bool stat_line;         // Interrupt fires on the rising edge
+		bool window_triggered;  // LY matched WY in this frame
+		uint8_t window_line;    // Next line of the window to show
+		void resync();
+		void write_register(const uint8_t reg, const uint8_t val);
+		void load_registers();
+		void publish();
+		uint32_t next_stat_change(const uint32_t t) const;
+		void draw_line(const uint8_t line);
+		void render_line(const uint8_t line, const bool window);
+		int select_sprites(const uint8_t line, uint8_t *selected) const;
+		void render_sprites(const uint8_t line, const uint8_t *bg, uint8_t *out);
+
+	public:
+		ppu_t();
+		void init(membus_t *membus_, scheduler_t *events_);
+		void set_screen(screen_t *screen_, tile_cache_t *tiles_);
+		void set_output(frame_queue_t *output_);
+		screen_t *get_screen() const { return screen; }
+		tile_cache_t *get_tiles() const { return tiles; }
+		frame_queue_t *get_output() const { return output; }
+		void update(const uint64_t when);
+		void catch_up(const uint64_t when);
+		void sync(const uint64_t when);
+		void save_state(state_writer_t &out) const;
+		void load_state(state_reader_t &in);
+};
+
+#endif
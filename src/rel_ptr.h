@@ -0,0 +1,34 @@
+#ifndef REL_PTR_H
+#define REL_PTR_H
+
+#include <stdint.h>
+
+/*
+ * Pointer stored as the distance from itself to its target. As long as
+ * both sit in the same block, a byte-wise copy of the block points at the
+ * copy of the target, so a machine_t can be cloned with memcpy. Don't copy
+ * a single rel_ptr_t around on its own, it would keep the old distance.
+ */
+template<typename T>
+class rel_ptr_t
+{
+	private:
+		intptr_t offset;    // 0 is null, nothing points at itself
+
+	public:
+		rel_ptr_t() : offset(0) {}
+		rel_ptr_t &operator=(T *target)
+		{
+			offset = target ? (const char*)target - (const char*)this : 0;
+			return *this;
+		}
+		T *get() const
+		{
+			return offset ? (T*)((const char*)this + offset) : 0;
+		}
+		T *operator->() const { return get(); }
+		T &operator*() const { return *get(); }
+		explicit operator bool() const { return offset != 0; }
+};
+
+#endif
@@ -0,0 +1,168 @@
+#include "rewind.h"
+
+#include <cstring>
+#include <algorithm>
+
+// Delta encoding: a control byte below 0x80 is followed by that many plus
+// one literal bytes. From 0x80 up, its low bits and the next byte give a
+// run length minus one, followed by the byte that repeats.
+#define RLE_MAX_LITERAL 0x80
+#define RLE_MAX_RUN     0x8000
+#define RLE_MIN_RUN     4
+
+//! Encodes @param a XOR @param b, both @param n bytes, into @param out,
+//! which needs room for n + n / 128 + 1 bytes. Returns the encoded size.
+static size_t delta_encode(const uint8_t *a, const uint8_t *b, const size_t n, uint8_t *out)
+{
+    uint8_t *o = out;
+    size_t i = 0;
+    size_t literal = 0;     // Start of pending literal bytes
+    while(i < n)
+    {
+        const uint8_t x = a[i] ^ b[i];
+        size_t run = 1;
+        while(i + run < n && run < RLE_MAX_RUN && (a[i + run] ^ b[i + run]) == x)
+            ++run;
+
+        if(run < RLE_MIN_RUN)
+        {
+            i += run;
+            continue;
+        }
+        while(literal < i)
+        {
+            const size_t len = std::min(i - literal, (size_t)RLE_MAX_LITERAL);
+            *o++ = len - 1;
+            for(size_t k = 0; k < len; ++k, ++literal)
+                *o++ = a[literal] ^ b[literal];
+        }
+        *o++ = 0x80 | ((run - 1) >> 8);
+        *o++ = (run - 1) & 0xFF;
+        *o++ = x;
+        i += run;
+        literal = i;
+    }
+    while(literal < n)
+    {
+        const size_t len = std::min(n - literal, (size_t)RLE_MAX_LITERAL);
+        *o++ = len - 1;
+        for(size_t k = 0; k < len; ++k, ++literal)
+            *o++ = a[literal] ^ b[literal];
+    }
+    return o - out;
+}
+
+//! XORs the delta in @param in, @param length bytes, into @param state.
+static void delta_apply(const uint8_t *in, const size_t length, uint8_t *state)
+{
+    const uint8_t *end = in + length;
+    while(in < end)
+    {
+        const uint8_t c = *in++;
+        if(c < 0x80)
+        {
+            for(int k = 0; k <= c; ++k)
+                *state++ ^= *in++;
+        } else {
+            const size_t run = (((c & 0x7F) << 8) | in[0]) + 1;
+            const uint8_t x = in[1];
+            in += 2;
+            if(x)
+            {
+                for(size_t k = 0; k < run; ++k)
+                    state[k] ^= x;
+            }
+            state += run;
+        }
+    }
+}
+
+//! Keeps up to @param capacity_ bytes of deltas, one state every
+//! @param interval_ frames. The space is only reserved, the buffers grow
+//! into it as states come in.
+rewind_t::rewind_t(const size_t capacity_, const unsigned interval_)
+    : capacity(capacity_), max_entries(std::max(capacity_ / 256, (size_t)16)), first(0), count(0), write_pos(0),
+      have_current(false), interval(std::max(interval_, 1u)), frames(0)
+{
+    ring.reserve(capacity);
+    entries.reserve(max_entries);
+}
+
+void rewind_t::drop_oldest()
+{
+    first = (first + 1) % entries.size();
+    --count;
+}
+
+//! Appends a delta, dropping the oldest ones in the way.
+void rewind_t::store(const uint8_t *data, const size_t length)
+{
+    if(length > capacity)
+        return;
+    // Until the ring first wraps, the deltas lie in one piece from 0 and
+    // nothing has been dropped, so both buffers can just get longer
+    if(write_pos + length > ring.size() && ring.size() < capacity)
+        ring.resize(std::min(capacity, std::max(write_pos + length, 2 * ring.size())));
+    if(count == entries.size() && first == 0 && entries.size() < max_entries)
+        entries.resize(std::min(max_entries, std::max((size_t)16, 2 * entries.size())));
+    if(write_pos + length > ring.size())
+    {
+        // Whatever is left in the tail is the oldest
+        while(count && entries[first].offset >= write_pos)
+            drop_oldest();
+        write_pos = 0;
+    }
+    while(count && entries[first].offset >= write_pos && entries[first].offset < write_pos + length)
+        drop_oldest();
+    if(count == entries.size())
+        drop_oldest();
+
+    memcpy(&ring[write_pos], data, length);
+    entry_t &entry = entries[(first + count) % entries.size()];
+    entry.offset = write_pos;
+    entry.length = length;
+    ++count;
+    write_pos += length;
+}
+
+//! Records the state of @param machine, call once per frame. Only every
+//! interval-th call stores anything. Allocates on the first call only.
+void rewind_t::push(const machine_t &machine)
+{
+    if(++frames < interval)
+        return;
+    frames = 0;
+
+    const size_t size = machine.save_state(0, 0);
+    if(next.size() != size)
+    {
+        next.resize(size);
+        delta.resize(size + size / RLE_MAX_LITERAL + 1);
+    }
+    machine.save_state(&next[0], size);
+    if(have_current && current.size() == size)
+        store(&delta[0], delta_encode(&current[0], &next[0], size, &delta[0]));
+    current.swap(next);
+    have_current = true;
+}
+
+//! Puts @param machine back one stored state. Returns false once there is
+//! nothing older left, the machine is then at the oldest state.
+bool rewind_t::step_back(machine_t &machine)
+{
+    if(!have_current)
+        return false;
+    frames = 0;
+    if(count == 0)
+    {
+        machine.load_state(&current[0], current.size());
+        return false;
+    }
+
+    const entry_t &newest = entries[(first + count - 1) % entries.size()];
+    delta_apply(&ring[newest.offset], newest.length, &current[0]);
+    write_pos = newest.offset;
+    --count;
+    machine.load_state(&current[0], current.size());
+    return true;
+}
@@ -0,0 +1,47 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "machine.h"
+
+/*
+ * Ring buffer of past machine states for rewinding. The newest state is
+ * kept whole, every older one only as the XOR with its successor, run
+ * length encoded. Those deltas are mostly zero runs and take a few hundred
+ * bytes. When the buffer is full the oldest states are dropped.
+ */
+class rewind_t
+{
+	private:
+		struct entry_t
+		{
+			size_t offset;
+			size_t length;
+		};
+		std::vector<uint8_t> ring;      // Grows as needed up to capacity
+		std::vector<entry_t> entries;   // Circular, oldest at first. Same
+		size_t capacity;
+		size_t max_entries;
+		size_t first;
+		size_t count;
+		size_t write_pos;
+		std::vector<uint8_t> current;   // Newest state
+		std::vector<uint8_t> next;
+		std::vector<uint8_t> delta;
+		bool have_current;
+		unsigned interval;
+		unsigned frames;
+		void drop_oldest();
+		void store(const uint8_t *data, const size_t length);
+
+	public:
+		rewind_t(const size_t capacity, const unsigned interval_);
+		void push(const machine_t &machine);
+		bool step_back(machine_t &machine);
+		size_t size() const { return count; }
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+
+#include <cstring>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SAVESTATE_MAGIC     0x53424750  // "PGBS"
+#define SAVESTATE_VERSION   3
+
+/*
+ * Little-endian serialization into a caller owned buffer. Writes past the
+ * end are dropped but still counted, so a pass with an empty buffer gives
+ * the size a state needs. Nothing here allocates.
+ */
+class state_writer_t
+{
+	private:
+		uint8_t *buf;
+		size_t capacity;
+		size_t used;
+
+	public:
+		state_writer_t(uint8_t *buf_, const size_t capacity_)
+		    : buf(buf_), capacity(capacity_), used(0) {}
+		size_t size() const { return used; }
+		bool good() const { return used <= capacity; }
+
+		void bytes(const void *src, const size_t n)
+		{
+			if(used + n <= capacity)
+				memcpy(buf + used, src, n);
+			used += n;
+		}
+		void u8(const uint8_t v)    { bytes(&v, 1); }
+		void u16(const uint16_t v)  { u8(v); u8(v >> 8); }
+		void u32(const uint32_t v)  { u16(v); u16(v >> 16); }
+		void u64(const uint64_t v)  { u32(v); u32(v >> 32); }
+		void flag(const bool v)     { u8(v ? 1 : 0); }
+};
+
+//! Reads what state_writer_t wrote. Reading past the end yields zeros and
+//! leaves good() false.
+class state_reader_t
+{
+	private:
+		const uint8_t *buf;
+		size_t capacity;
+		size_t used;
+
+	public:
+		state_reader_t(const uint8_t *buf_, const size_t capacity_)
+		    : buf(buf_), capacity(capacity_), used(0) {}
+		size_t size() const { return used; }
+		bool good() const { return used <= capacity; }
+
+		void bytes(void *dst, const size_t n)
+		{
+			if(used + n <= capacity)
+				memcpy(dst, buf + used, n);
+			else
+				memset(dst, 0x00, n);
+			used += n;
+		}
+		uint8_t u8()    { uint8_t v; bytes(&v, 1); return v; }
+		uint16_t u16()  { const uint16_t lo = u8(); return lo | (u8() << 8); }
+		uint32_t u32()  { const uint32_t lo = u16(); return lo | ((uint32_t)u16() << 16); }
+		uint64_t u64()  { const uint64_t lo = u32(); return lo | ((uint64_t)u32() << 32); }
+		bool flag()     { return u8() != 0; }
+};
+
+#endif
@@ -0,0 +1,92 @@
+#include "scheduler.h"
+
+scheduler_t::scheduler_t()
+    : next_at(EV_NEVER), handler(0)
+{
+    for(int i = 0; i < EV_COUNT; ++i)
+        at[i] = EV_NEVER;
+}
+
+void scheduler_t::set_clock(const uint64_t *clock_)
+{
+    clock = clock_;
+}
+
+void scheduler_t::set_handler(event_handler_t handler_, void *ctx)
+{
+    handler = handler_;
+    handler_ctx = (uint8_t*)ctx;
+}
+
+uint64_t scheduler_t::now() const
+{
+    return *clock;
+}
+
+void scheduler_t::schedule(const event_e ev, const uint64_t when)
+{
+    at[ev] = when;
+    if(when < next_at)
+        next_at = when;
+    else
+        update_next();
+}
+
+void scheduler_t::schedule_in(const event_e ev, const uint32_t cycles)
+{
+    schedule(ev, now() + cycles);
+}
+
+void scheduler_t::cancel(const event_e ev)
+{
+    at[ev] = EV_NEVER;
+    update_next();
+}
+
+bool scheduler_t::is_pending(const event_e ev) const
+{
+    return at[ev] != EV_NEVER;
+}
+
+//! Fires every event that is due by now, earliest first. Handlers may
+//! schedule new events, those fire in the same call when already due.
+void scheduler_t::dispatch()
+{
+    const uint64_t t = now();
+    while(next_at <= t)
+    {
+        int ev = 0;
+        for(int i = 1; i < EV_COUNT; ++i)
+        {
+            if(at[i] < at[ev])
+                ev = i;
+        }
+        const uint64_t when = at[ev];
+        cancel((event_e)ev);
+        if(handler)
+            handler(handler_ctx.get(), (event_e)ev, when);
+    }
+}
+
+void scheduler_t::update_next()
+{
+    next_at = EV_NEVER;
+    for(int i = 0; i < EV_COUNT; ++i)
+    {
+        if(at[i] < next_at)
+            next_at = at[i];
+    }
+}
+
+void scheduler_t::save_state(state_writer_t &out) const
+{
+    for(int i = 0; i < EV_COUNT; ++i)
+        out.u64(at[i]);
+}
+
+void scheduler_t::load_state(state_reader_t &in)
+{
+    for(int i = 0; i < EV_COUNT; ++i)
+        at[i] = in.u64();
+    update_next();
+}
@@ -0,0 +1,55 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+
+#include "savestate.h"
+#include "rel_ptr.h"
+
+#define EV_NEVER    UINT64_MAX
+
+typedef enum
+{
+	EV_PPU,     // Next PPU mode change
+	EV_TIMER,   // TIMA overflow
+	EV_SERIAL,  // Serial transfer complete
+	EV_DMA,     // OAM DMA finished
+	EV_JOYPAD,  // Joypad line went low
+	EV_IRQ,     // IF, IE or IME changed, interrupts need checking
+	EV_COUNT
+} event_e;
+
+//! Called for every due event with the cycle it was scheduled for.
+typedef void (*event_handler_t)(void *ctx, const event_e ev, const uint64_t when);
+
+/*
+ * Keeps the next emulated cycle of every timed hardware event, so the CPU
+ * loop only has to compare its cycle counter against next(). At most one
+ * event of each kind is pending, rescheduling replaces the old one.
+ */
+class scheduler_t
+{
+	private:
+		uint64_t at[EV_COUNT];
+		uint64_t next_at;
+		rel_ptr_t<const uint64_t> clock;
+		event_handler_t handler;
+		rel_ptr_t<uint8_t> handler_ctx;
+		void update_next();
+
+	public:
+		scheduler_t();
+		void set_clock(const uint64_t *clock_);
+		void set_handler(event_handler_t handler_, void *ctx);
+		uint64_t now() const;
+		uint64_t next() const { return next_at; }
+		void schedule(const event_e ev, const uint64_t when);
+		void schedule_in(const event_e ev, const uint32_t cycles);
+		void cancel(const event_e ev);
+		bool is_pending(const event_e ev) const;
+		void dispatch();
+		void save_state(state_writer_t &out) const;
+		void load_state(state_reader_t &in);
+};
+
+#endif
@@ -2,73 +2,60 @@
 #define SDL_VIDEODEC_H
 
 #define SHOW_TILEMAP
+#define SCALE       3       // Initial window size, resizing keeps integer scaling
 
 #include <sys/time.h>
 #include <string>
 #include <iostream>
+#include <atomic>
 #include <SDL2/SDL.h>
 
 #include "membus.h"
-
-struct tile_t
-{
-	void decode(const uint8_t tile_n, const uint8_t LCDC, uint8_t *vram);
-	void print();
-	uint8_t data[8][8];
-};
-
-struct sprite_t
-{
-	void decode(const uint8_t sprite_n, uint8_t *spt);
-	uint8_t y_pos;
-	uint8_t x_pos;
-	uint8_t tile_n[2];
-	bool bg_prio, yflip, xflip;
-};
+#include "ppu.h"
+#include "frame_queue.h"
+#include "frame_pacer.h"
+#include "palette.h"
+#include "tile_decode.h"
 
 class sdl_videodec_t
 {
 	private:
-		membus_t *membus;
+		keypad_t *keypad;
 		SDL_Window *window;
 		SDL_Renderer *renderer;
+		SDL_Texture *texture;
+		Uint32 framebuffer[SCREEN_H * SCREEN_W];    // RGBA8888, uploaded once per frame
 	#ifdef SHOW_TILEMAP
 		SDL_Window *tilemap_window;
 		SDL_Renderer *tilemap_renderer;
+		SDL_Texture *tilemap_texture;
+		Uint32 tilemap_buffer[128 * 128];
 	#endif
 		SDL_Event event;
-		uint8_t tiledata[32][32];
-		tile_t tileset[256];
-		sprite_t spriteset[40];
-		Uint32 last_tick;
-		Uint8 PALETTE[5];
-		Uint8 bg_pal[4];
-		Uint8 sp_pal[2][4];
+		frame_queue_t *frames;      // Everything shown comes from here
+		bool vsync;                 // Presenting waits for the display's refresh
+		frame_pacer_t pacer;        // Otherwise this does
+		palette_t palette;
+		Uint32 lut[PALETTE_SHADES];     // The palette as RGBA8888, redone when it changes
+		bool recolor;                   // Framebuffer is in an old palette
 
-		uint8_t *vram;
-		uint8_t *spt;
-		uint8_t *LCDC;
-		uint8_t *SCY;
-		uint8_t *SCX;
-		uint8_t *LY;
-		uint8_t *BGP;
-		uint8_t *OBP0;
-		uint8_t *OBP1;
-		uint8_t *WY;
-		uint8_t *WX;
 		bool panicked;
-		bool asleep;
-		bool debug;
+		std::atomic<bool> debug;        // Taken by the CPU thread
+		bool rewind_held;
+		void present(SDL_Renderer *target, SDL_Texture *tex, const Uint32 *pixels, const int width);
+		std::atomic<uint32_t> rewind_steps;    // Taken by the CPU thread
 	public:
 		sdl_videodec_t();
 		~sdl_videodec_t();
-		void init(membus_t *mem);
-		void run();
-		void decode();
+		void init(keypad_t *keypad_, frame_queue_t *frames_);
+		bool run();
 		void print();
+		void set_palette(const palette_t &palette_);
+		void next_palette();
 		void panic();
 		bool is_panicked();
-		bool requesting_debug();
+		bool take_debug_request();
+		uint32_t take_rewind_steps();
 	#ifdef SHOW_TILEMAP
 		void show_tilemap();
 	#endif
@@ -0,0 +1,100 @@
+#include "snapshot.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+snapshotter_t::snapshotter_t(machine_t *machine_)
+    : machine(machine_), shadow(0)
+{
+    if(posix_memalign((void**)&shadow, SNAPSHOT_PAGE_SIZE, sizeof(machine_t)) != 0)
+        throw std::bad_alloc();
+    reset();
+}
+
+snapshotter_t::~snapshotter_t()
+{
+    free(shadow);
+}
+
+//! Starts a new chain with a snapshot of every page, for when the machine
+//! was changed behind the snapshotter's back (copy_from, load_state).
+void snapshotter_t::reset()
+{
+    last.reset();
+    machine->memory.start_tracking();
+    const size_t size = machine->size();
+    std::shared_ptr<snapshot_t> snapshot(new snapshot_t(last));
+    snapshot->data.assign((const uint8_t*)machine, (const uint8_t*)machine + size);
+    for(uint32_t i = 0; i < size / SNAPSHOT_PAGE_SIZE; ++i)
+        snapshot->pages.push_back(i);
+    memcpy(shadow, machine, size);
+    last = snapshot;
+}
+
+//! Stores the pages changed since the previous snapshot, which becomes the
+//! parent. Call between frames.
+std::shared_ptr<const snapshot_t> snapshotter_t::take()
+{
+    std::shared_ptr<snapshot_t> snapshot(new snapshot_t(last));
+    uint8_t *block = (uint8_t*)machine;
+    const uint32_t count = machine->size() / SNAPSHOT_PAGE_SIZE;
+
+    // Tracked pages first, restarting the tracking changes the page table
+    // and the written flags, which are then picked up by the comparison.
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        const uint8_t *page = block + i * SNAPSHOT_PAGE_SIZE;
+        if(machine->memory.page_written(page) > 0)
+        {
+            snapshot->pages.push_back(i);
+            snapshot->data.insert(snapshot->data.end(), page, page + SNAPSHOT_PAGE_SIZE);
+            memcpy(shadow + i * SNAPSHOT_PAGE_SIZE, page, SNAPSHOT_PAGE_SIZE);
+        }
+    }
+    machine->memory.start_tracking();
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        const uint8_t *page = block + i * SNAPSHOT_PAGE_SIZE;
+        if(machine->memory.page_written(page) < 0 &&
+           memcmp(page, shadow + i * SNAPSHOT_PAGE_SIZE, SNAPSHOT_PAGE_SIZE) != 0)
+        {
+            snapshot->pages.push_back(i);
+            snapshot->data.insert(snapshot->data.end(), page, page + SNAPSHOT_PAGE_SIZE);
+            memcpy(shadow + i * SNAPSHOT_PAGE_SIZE, page, SNAPSHOT_PAGE_SIZE);
+        }
+    }
+
+    last = snapshot;
+    return last;
+}
+
+//! Puts the machine back into the state of @param snapshot, which has to
+//! come from this snapshotter. The next snapshot continues from there.
+void snapshotter_t::restore(const std::shared_ptr<const snapshot_t> &snapshot)
+{
+    uint8_t *block = (uint8_t*)machine;
+    const uint32_t count = machine->size() / SNAPSHOT_PAGE_SIZE;
+    restored.assign(count, false);
+    uint32_t missing = count;
+
+    // Newest version of every page, walking towards the full snapshot
+    for(const snapshot_t *s = snapshot.get(); s && missing; s = s->get_parent())
+    {
+        for(size_t n = 0; n < s->pages.size(); ++n)
+        {
+            const uint32_t i = s->pages[n];
+            if(restored[i])
+                continue;
+            memcpy(block + i * SNAPSHOT_PAGE_SIZE, &s->data[n * SNAPSHOT_PAGE_SIZE], SNAPSHOT_PAGE_SIZE);
+            restored[i] = true;
+            --missing;
+        }
+    }
+
+    machine->memory.mark_save_dirty();
+    machine->memory.mark_vram_dirty();
+    machine->memory.start_tracking();
+    memcpy(shadow, block, machine->size());
+    last = snapshot;
+}
@@ -0,0 +1,55 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <vector>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "machine.h"
+
+#define SNAPSHOT_PAGE_SIZE  0x100
+
+/*
+ * Machine state stored as the 256 byte pages of the machine_t block that
+ * changed since its parent. The first snapshot of a chain holds every page.
+ */
+class snapshot_t
+{
+	private:
+		std::shared_ptr<const snapshot_t> parent;
+		std::vector<uint32_t> pages;    // Page numbers within the block
+		std::vector<uint8_t> data;      // SNAPSHOT_PAGE_SIZE bytes per page
+		friend class snapshotter_t;
+
+	public:
+		snapshot_t(const std::shared_ptr<const snapshot_t> &parent_) : parent(parent_) {}
+		const snapshot_t *get_parent() const { return parent.get(); }
+		size_t size() const { return data.size(); }
+};
+
+/*
+ * Takes incremental snapshots of one machine. VRAM, WRAM, OAM and
+ * cartridge RAM pages are known to be unchanged from membus_t's write
+ * tracking, the remaining few pages (registers, I/O) are compared against
+ * a copy of the block as of the last snapshot.
+ */
+class snapshotter_t
+{
+	private:
+		machine_t *machine;
+		uint8_t *shadow;
+		std::shared_ptr<const snapshot_t> last;
+		std::vector<bool> restored;
+		snapshotter_t(const snapshotter_t&);
+		snapshotter_t &operator=(const snapshotter_t&);
+
+	public:
+		snapshotter_t(machine_t *machine_);
+		~snapshotter_t();
+		std::shared_ptr<const snapshot_t> take();
+		void restore(const std::shared_ptr<const snapshot_t> &snapshot);
+		void reset();
+};
+
+#endif
@@ -0,0 +1,77 @@
+#include "tile_cache.h"
+#include "tile_decode.h"
+
+#include <cstring>
+
+tile_cache_t::tile_cache_t()
+    : source(0), unsigned_tiles(true)
+{
+}
+
+//! Decodes @param count slots from @param first on, both ways round.
+void tile_cache_t::decode_tiles(const uint8_t *vram, const uint16_t first, const uint16_t count)
+{
+    decode_tile_rows(vram + 16 * first, tiles[first], 8 * count);
+    for(uint16_t t = first; t < first + count; ++t)
+    {
+        for(int y = 0; y < 8; ++y)
+        {
+            for(int x = 0; x < 8; ++x)
+                flipped[t][8*y + x] = tiles[t][8*y + 7 - x];
+        }
+    }
+}
+
+void tile_cache_t::draw_cell(const uint8_t map, const uint8_t row, const uint8_t col, const uint16_t slot_)
+{
+    for(int y = 0; y < 8; ++y)
+        memcpy(&planes[map][8*row + y][8*col], &tiles[slot_][8*y], 8);
+}
+
+//! Catches up with the VRAM of @param membus, at @param vram, and the tile
+//! addressing of LCDC bit 4, @param unsigned_tiles_.
+void tile_cache_t::update(membus_t &membus, const uint8_t *vram, const bool unsigned_tiles_)
+{
+    if(source != &membus)
+    {
+        membus.mark_vram_dirty();
+        source = &membus;
+    }
+    const bool redraw = unsigned_tiles != unsigned_tiles_;
+    if(!redraw && !membus.vram_changed())
+        return;
+
+    vram_dirty_t dirty;
+    membus.take_vram_dirty(dirty);
+    unsigned_tiles = unsigned_tiles_;
+
+    // Runs of written tiles go to the decoder in one piece
+    for(uint16_t t = 0; t < VRAM_TILES;)
+    {
+        if(!dirty.tiles[t])
+        {
+            ++t;
+            continue;
+        }
+        uint16_t end = t;
+        while(end < VRAM_TILES && dirty.tiles[end])
+            ++end;
+        decode_tiles(vram, t, end - t);
+        t = end;
+    }
+
+    for(uint8_t map = 0; map < TILE_MAPS; ++map)
+    {
+        for(uint8_t row = 0; row < 32; ++row)
+        {
+            const uint8_t *cells = vram + 0x1800 + 0x400 * map + 32 * row;
+            const bool row_dirty = redraw || dirty.map_rows[32 * map + row];
+            for(uint8_t col = 0; col < 32; ++col)
+            {
+                const uint16_t s = slot(cells[col], unsigned_tiles);
+                if(row_dirty || dirty.tiles[s])
+                    draw_cell(map, row, col, s);
+            }
+        }
+    }
+}
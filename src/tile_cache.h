@@ -0,0 +1,51 @@
+#ifndef TILE_CACHE_H
+#define TILE_CACHE_H
+
+#include <stdint.h>
+
+#include "membus.h"
+
+#define TILE_MAPS       2
+#define PLANE_SIZE      256     // A tile map drawn out is 256x256 pixels
+
+/*
+ * Decoded VRAM: every tile slot as colour numbers, also mirrored for
+ * sprites, and both tile maps drawn out as planes. It only redoes what
+ * membus_t noted as written, so a static screen costs nothing to keep
+ * current. Like screen_t it is derived output outside the machine, and
+ * starts over when another machine uses it.
+ */
+class tile_cache_t
+{
+	private:
+		const membus_t *source;     // Machine the cache matches, 0 for none
+		bool unsigned_tiles;        // LCDC bit 4 the planes were drawn with
+		uint8_t tiles[VRAM_TILES][64];
+		uint8_t flipped[VRAM_TILES][64];
+		uint8_t planes[TILE_MAPS][PLANE_SIZE][PLANE_SIZE];
+		void decode_tiles(const uint8_t *vram, const uint16_t first, const uint16_t count);
+		void draw_cell(const uint8_t map, const uint8_t row, const uint8_t col, const uint16_t slot);
+		tile_cache_t(const tile_cache_t&);
+		tile_cache_t &operator=(const tile_cache_t&);
+
+	public:
+		tile_cache_t();
+		void update(membus_t &membus, const uint8_t *vram, const bool unsigned_tiles_);
+		//! Slot of tile number @param tile_n as a map refers to it.
+		static uint16_t slot(const uint8_t tile_n, const bool unsigned_tiles_)
+		{
+			return (unsigned_tiles_ || tile_n >= 0x80) ? tile_n : 0x100 + tile_n;
+		}
+		//! The 8x8 colour numbers of @param slot, mirrored if @param xflip.
+		const uint8_t *tile(const uint16_t slot_, const bool xflip) const
+		{
+			return xflip ? flipped[slot_] : tiles[slot_];
+		}
+		//! Line @param y of tile map @param map (0 for 0x9800, 1 for 0x9C00).
+		const uint8_t *plane_row(const uint8_t map, const uint8_t y) const
+		{
+			return planes[map][y];
+		}
+};
+
+#endif
@@ -0,0 +1,129 @@
+#include "tile_decode.h"
+
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define TILE_DECODE_X86
+#include <immintrin.h>
+#endif
+
+static void decode_scalar(const uint8_t *src, uint8_t *dst, const size_t rows)
+{
+    for(size_t r = 0; r < rows; ++r)
+        decode_tile_row(src[2*r], src[2*r + 1], dst + 8*r);
+}
+
+#ifdef TILE_DECODE_X86
+
+//! Scatters the bits of each plane to one byte per pixel and reverses the
+//! bytes, the leftmost pixel is the top bit.
+__attribute__((target("bmi2")))
+static void decode_bmi2(const uint8_t *src, uint8_t *dst, const size_t rows)
+{
+    for(size_t r = 0; r < rows; ++r)
+    {
+        uint64_t px = _pdep_u64(src[2*r], 0x0101010101010101ULL)
+                    | _pdep_u64(src[2*r + 1], 0x0202020202020202ULL);
+        px = __builtin_bswap64(px);
+        memcpy(dst + 8*r, &px, 8);
+    }
+}
+
+//! One row out of eight 16 bit lanes that all hold its planes, hi:lo.
+//! Lane i tests bit 7 - i of both bytes.
+static inline __m128i sse2_row(const __m128i planes)
+{
+    const __m128i bits = _mm_set_epi16(0x0101, 0x0202, 0x0404, 0x0808,
+                                       0x1010, 0x2020, 0x4040, (short)0x8080);
+    const __m128i set = _mm_cmpeq_epi8(_mm_and_si128(planes, bits), bits);
+    return _mm_or_si128(_mm_and_si128(set, _mm_set1_epi16(0x0001)),
+                        _mm_and_si128(_mm_srli_epi16(set, 8), _mm_set1_epi16(0x0002)));
+}
+
+//! Two rows, from 32 bit lanes that hold rows a and b twice each (a a b b).
+static inline void sse2_pair(const __m128i ab, uint8_t *dst)
+{
+    const __m128i a = _mm_unpacklo_epi64(ab, ab);
+    const __m128i b = _mm_unpackhi_epi64(ab, ab);
+    _mm_storeu_si128((__m128i*)dst, _mm_packus_epi16(sse2_row(a), sse2_row(b)));
+}
+
+//! Eight rows per step: the planes of a row are spread over a register by
+//! unpacking and then tested against one bit per lane.
+__attribute__((target("sse2")))
+static void decode_sse2(const uint8_t *src, uint8_t *dst, const size_t rows)
+{
+    size_t r = 0;
+    for(; r + 8 <= rows; r += 8)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(src + 2*r));
+        const __m128i lo = _mm_unpacklo_epi16(v, v);   // Rows 0-3
+        const __m128i hi = _mm_unpackhi_epi16(v, v);   // Rows 4-7
+        sse2_pair(_mm_unpacklo_epi32(lo, lo), dst + 8*r);
+        sse2_pair(_mm_unpackhi_epi32(lo, lo), dst + 8*r + 16);
+        sse2_pair(_mm_unpacklo_epi32(hi, hi), dst + 8*r + 32);
+        sse2_pair(_mm_unpackhi_epi32(hi, hi), dst + 8*r + 48);
+    }
+    decode_scalar(src + 2*r, dst + 8*r, rows - r);
+}
+
+//! Four rows per register: a shuffle copies each plane byte to the eight
+//! pixels it makes, which then test one bit each.
+__attribute__((target("avx2")))
+static void decode_avx2(const uint8_t *src, uint8_t *dst, const size_t rows)
+{
+    const __m256i bits = _mm256_setr_epi8(
+        (char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+        (char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+        (char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+        (char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+    // The shuffle works within 128 bit halves, both hold all eight rows
+    const __m256i lo_first = _mm256_setr_epi8(
+        0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, 2, 2, 2, 2, 2,
+        4, 4, 4, 4, 4, 4, 4, 4, 6, 6, 6, 6, 6, 6, 6, 6);
+    const __m256i lo_second = _mm256_add_epi8(lo_first, _mm256_set1_epi8(8));
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i two = _mm256_set1_epi8(2);
+
+    size_t r = 0;
+    for(; r + 8 <= rows; r += 8)
+    {
+        const __m256i v = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(src + 2*r)));
+        for(int half = 0; half < 2; ++half)
+        {
+            const __m256i idx = half ? lo_second : lo_first;
+            const __m256i lo = _mm256_shuffle_epi8(v, idx);
+            const __m256i hi = _mm256_shuffle_epi8(v, _mm256_add_epi8(idx, one));
+            const __m256i px = _mm256_or_si256(
+                _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(lo, bits), bits), one),
+                _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(hi, bits), bits), two));
+            _mm256_storeu_si256((__m256i*)(dst + 8*r + 32*half), px);
+        }
+    }
+    decode_scalar(src + 2*r, dst + 8*r, rows - r);
+}
+
+#endif /* TILE_DECODE_X86 */
+
+std::vector<tile_decoder_t> tile_decoders()
+{
+    std::vector<tile_decoder_t> list;
+#ifdef TILE_DECODE_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        list.push_back(tile_decoder_t{"avx2", decode_avx2});
+    if(__builtin_cpu_supports("sse2"))
+        list.push_back(tile_decoder_t{"sse2", decode_sse2});
+    // PDEP is microcoded and slow on AMD before Zen 3, so it comes last
+    if(__builtin_cpu_supports("bmi2"))
+        list.push_back(tile_decoder_t{"bmi2", decode_bmi2});
+#endif
+    list.push_back(tile_decoder_t{"scalar", decode_scalar});
+    return list;
+}
+
+void decode_tile_rows(const uint8_t *src, uint8_t *dst, const size_t rows)
+{
+    static const tile_decode_fn_t best = tile_decoders().front().decode;
+    best(src, dst, rows);
+}
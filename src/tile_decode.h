@@ -0,0 +1,36 @@
+#ifndef TILE_DECODE_H
+#define TILE_DECODE_H
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TILE_ROW_BYTES      2       // Two bitplanes, as stored in VRAM
+#define TILE_ROW_PIXELS     8
+
+//! The colour numbers of a tile row, leftmost first, into @param px from
+//! its two bitplane bytes @param lo and @param hi.
+inline void decode_tile_row(const uint8_t lo, const uint8_t hi, uint8_t *px)
+{
+	for(int i = 0; i < 8; ++i)
+		px[i] = (((hi >> (7 - i)) & 1) << 1) | ((lo >> (7 - i)) & 1);
+}
+
+//! Decodes @param rows consecutive tile rows from @param src (2 bytes each)
+//! into 8 colour numbers each at @param dst.
+typedef void (*tile_decode_fn_t)(const uint8_t *src, uint8_t *dst, const size_t rows);
+
+struct tile_decoder_t
+{
+	const char *name;
+	tile_decode_fn_t decode;
+};
+
+//! Decoders this CPU can run, fastest first. The last one is plain C++.
+std::vector<tile_decoder_t> tile_decoders();
+
+//! Decodes whole tile sets with the fastest decoder this CPU can run, see
+//! tile_decode_fn_t.
+void decode_tile_rows(const uint8_t *src, uint8_t *dst, const size_t rows);
+
+#endif